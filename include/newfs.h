@@ -1,16 +1,19 @@
 #ifndef _WULINSIFS_H_
 #define _WULINSIFS_H_
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
 #include "fcntl.h"
 #include "string.h"
 #include "fuse.h"
+#include "fuse_lowlevel.h"
 #include <stddef.h>
 #include "ddriver.h"
 #include "errno.h"
+#include <pthread.h>
+#include <time.h>
 #include "types.h"
 
 #define NEWFS_MAGIC                  /* TODO: Define by yourself */
@@ -20,6 +23,7 @@
 * SECTION: macro debug
 *******************************************************************************/
 #define NEWFS_DBG(fmt, ...) do { printf("NEWFS_DBG: " fmt, ##__VA_ARGS__); } while(0)
+#define NEWFS_RA_STATE(fi)  ((fi) != NULL ? (struct newfs_ra_state *)(uintptr_t)(fi)->fh : NULL)   /* 打开文件的预读状态 */
 
 /******************************************************************************
 * SECTION: newfs_utils.c
@@ -28,21 +32,156 @@ char*			   	newfs_get_fname(const char* path);
 int 			   	newfs_calc_lvl(const char * path);
 int 			   	newfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   	newfs_driver_write(int offset, uint8_t *in_content, int size);
+int 			   	newfs_driver_readv(struct newfs_iovec* iov, int iovcnt);
+int 			   	newfs_driver_writev(struct newfs_iovec* iov, int iovcnt);
 int 			   	newfs_mount(struct custom_options options);
 int 			   	newfs_umount();
+uint32_t 		   	newfs_hash_name(const char* name);
+struct newfs_dentry* newfs_index_find(struct newfs_inode* inode, const char* fname);
+void 			   	newfs_index_remove(struct newfs_inode* inode, struct newfs_dentry* dentry);
+int 			   	newfs_dir_grow(struct newfs_inode* inode, int rec_len);
 int 			   	newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
+int 			   	newfs_drop_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
+void 			   	newfs_dir_trim(struct newfs_inode* inode);
+void 			   	newfs_dirty_inode(struct newfs_inode* inode);
+void 			   	newfs_dirty_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry);
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry);
+int 				newfs_remove_dentry(struct newfs_dentry* dentry);
+struct newfs_dentry* newfs_create_dentry(struct newfs_dentry* parent, const char* fname, FILE_TYPE ftype);
+int 				newfs_move_dentry(struct newfs_dentry* dentry, struct newfs_dentry* to_parent, const char* fname,
+									  struct newfs_dentry* target);
+int 				newfs_bmap(struct newfs_inode* inode, int lblk, int* run);
+int 				newfs_extend(struct newfs_inode* inode, int blks);
+void 				newfs_shrink(struct newfs_inode* inode, int blks);
+int 				newfs_file_read(struct newfs_inode* inode, uint8_t* buf, int size, int offset);
+int 				newfs_file_read_buf(struct newfs_inode* inode, struct fuse_bufvec** bufp, int size, int offset);
+void 				newfs_free_bufvec(struct fuse_bufvec* vec);
+int 				newfs_file_write(struct newfs_inode* inode, const uint8_t* buf, int size, int offset);
+int 				newfs_file_truncate(struct newfs_inode* inode, int size);
 int 				newfs_sync_inode(struct newfs_inode * inode);
+int 				newfs_commit();
+int 				newfs_flush();
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino);
+struct newfs_inode* newfs_dentry_inode(struct newfs_dentry* dentry);
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir);
+int 				newfs_dir_slots(struct newfs_inode* inode, struct newfs_dentry*** slots);
 struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean* is_root);
 
+/******************************************************************************
+* SECTION: newfs_layout.c
+*******************************************************************************/
+int 			   	newfs_layout_calc(int sz_disk, int sz_blk, int inode_ratio, int journal_blks,
+									  struct newfs_super_d* super_d);
+int 			   	newfs_layout_write(const char* path, struct newfs_super_d* super_d, int sz_blk);
+
+/******************************************************************************
+* SECTION: newfs_dev.c
+*******************************************************************************/
+const struct newfs_dev_ops* newfs_dev_lookup(const char* name);
+
+/******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 			   	newfs_dev_read(int blkno, uint8_t **blks, int cnt);
+int 			   	newfs_dev_write(int blkno, uint8_t **blks, int cnt);
+int 			   	newfs_dev_flush();
+int 			   	newfs_dev_submit(struct newfs_dev_req* reqs, int n);
+int 			   	newfs_dev_splice_fd();
+int 			   	newfs_bcache_init(int nbufs);
+struct newfs_buf*  	newfs_bcache_lookup(int blkno);
+struct newfs_buf*  	newfs_bcache_get(int blkno, boolean is_fill);
+void 			   	newfs_bcache_mark_dirty(struct newfs_buf* buf);
+int 			   	newfs_bcache_collect(int flag);
+int 			   	newfs_bcache_write_runs(struct newfs_buf** bufs, int n);
+int 			   	newfs_bcache_prefetch(int blkno, int cnt);
+int 			   	newfs_bcache_flush();
+int 			   	newfs_bcache_shrink();
+void 			   	newfs_bcache_destroy();
+
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int 			   	newfs_journal_mount(struct newfs_super_d* super_d);
+void 			   	newfs_journal_begin();
+int 			   	newfs_journal_commit_locked();
+int 			   	newfs_journal_commit();
+int 			   	newfs_journal_checkpoint();
+int 			   	newfs_journal_reclaim();
+boolean 		   	newfs_journal_is_logged(int blkno);
+void 			   	newfs_journal_synced();
+int 			   	newfs_journal_sync();
+void 			   	newfs_journal_umount();
+
+/******************************************************************************
+* SECTION: newfs_bitmap.c
+*******************************************************************************/
+int 			   	newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits, int group_bits,
+									  uint8_t* map_dirty, int map_offset, int map_stride);
+int 			   	newfs_bitmap_load(struct newfs_bitmap* bm);
+int 			   	newfs_bitmap_format(struct newfs_bitmap* bm);
+int 			   	newfs_bitmap_sync(struct newfs_bitmap* bm);
+boolean 		   	newfs_bitmap_owns(struct newfs_bitmap* bm, int blkno);
+void 			   	newfs_bitmap_destroy(struct newfs_bitmap* bm);
+int 			   	newfs_bitmap_pin(struct newfs_bitmap* bm);
+void 			   	newfs_bitmap_unpin(struct newfs_bitmap* bm);
+int 			   	newfs_bitmap_alloc(struct newfs_bitmap* bm, int goal);
+void 			   	newfs_bitmap_free(struct newfs_bitmap* bm, int bit);
+int 			   	newfs_bitmap_alloc_run(struct newfs_bitmap* bm, int goal, int want, int* len);
+void 			   	newfs_bitmap_free_run(struct newfs_bitmap* bm, int start, int len);
+int 			   	newfs_bitmap_least_used(struct newfs_bitmap* bm, int from);
+
+/******************************************************************************
+* SECTION: newfs_slab.c
+*******************************************************************************/
+int 			   	newfs_slab_init(struct newfs_slab* slab, int obj_sz);
+void 			   	newfs_slab_destroy(struct newfs_slab* slab);
+void* 			   	newfs_slab_alloc(struct newfs_slab* slab);
+void 			   	newfs_slab_free(struct newfs_slab* slab, void* obj);
+int 			   	newfs_slabs_init();
+void 			   	newfs_slabs_destroy();
+char* 			   	newfs_name_dup(const char* name);
+void 			   	newfs_name_free(char* name);
+struct newfs_dentry* new_dentry(const char* fname, FILE_TYPE ftype);
+void 			   	free_dentry(struct newfs_dentry* dentry);
+
+/******************************************************************************
+* SECTION: newfs_dcache.c
+*******************************************************************************/
+int 			   	newfs_dcache_init();
+void 			   	newfs_dcache_destroy();
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find);
+void 			   	newfs_dcache_add(const char* path, struct newfs_dentry* dentry, boolean is_find);
+void 			   	newfs_dcache_invalidate_neg();
+void 			   	newfs_dcache_invalidate(const char* path);
+
+/******************************************************************************
+* SECTION: newfs_wb.c
+*******************************************************************************/
+void 			   	newfs_mark_dirty(int bytes);
+void 			   	newfs_mark_clean();
+void 			   	newfs_wb_throttle();
+int 			   	newfs_wb_start(struct custom_options options);
+void 			   	newfs_wb_stop();
+
+/******************************************************************************
+* SECTION: newfs_ra.c
+*******************************************************************************/
+void 			   	newfs_ra_update(struct newfs_inode* inode, struct newfs_ra_state* st, int offset, int size);
+int 			   	newfs_ra_start(struct custom_options options);
+void 			   	newfs_ra_stop();
+
+/******************************************************************************
+* SECTION: newfs_ll.c
+*******************************************************************************/
+int 			   	newfs_ll_main(struct fuse_args* args);
+
 /******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
 void* 			   	newfs_init(struct fuse_conn_info *);
 void  			   	newfs_destroy(void *);
 int   			   	newfs_mkdir(const char *, mode_t);
+void  			   	newfs_fill_stat(struct newfs_dentry *, struct stat *);
 int   			   	newfs_getattr(const char *, struct stat *);
 int   			   	newfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
 						                struct fuse_file_info *);
@@ -51,14 +190,21 @@ int   			   	newfs_write(const char *, const char *, size_t, off_t,
 					                  struct fuse_file_info *);
 int   			   	newfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
+int   			   	newfs_write_buf(const char *, struct fuse_bufvec *, off_t,
+					                      struct fuse_file_info *);
+int   			   	newfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t,
+					                     struct fuse_file_info *);
 int   			   	newfs_access(const char *, int);
 int   			   	newfs_unlink(const char *);
 int   			   	newfs_rmdir(const char *);
 int   			   	newfs_rename(const char *, const char *);
 int   			   	newfs_utimens(const char *, const struct timespec tv[2]);
 int   			   	newfs_truncate(const char *, off_t);
+int   			   	newfs_fsync(const char *, int, struct fuse_file_info *);
 			
 int   			   	newfs_open(const char *, struct fuse_file_info *);
+int   			   	newfs_release(const char *, struct fuse_file_info *);
 int   			   	newfs_opendir(const char *, struct fuse_file_info *);
+int   			   	newfs_releasedir(const char *, struct fuse_file_info *);
 
 #endif  /* _newfs_H_ */
\ No newline at end of file
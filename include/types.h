@@ -23,6 +23,7 @@ typedef enum file_type {
 #define NEWFS_MAGIC_NUM         0x52415453       // 幻数，用于识别文件系统，可自行定义
 #define NEWFS_SUPER_OFS         0               // 文件系统中超级块偏移量
 #define NEWFS_ROOT_INO          0
+#define NEWFS_JOURNAL_MAGIC     0x4c4e524a       // 日志超级块、描述块和提交块的幻数
 
 #define MAX_NAME_LEN            128     
 #define NEWFS_ERROR_NONE          0
@@ -35,9 +36,17 @@ typedef enum file_type {
 #define NEWFS_ERROR_UNSUPPORTED   ENXIO
 #define NEWFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NEWFS_ERROR_NOTDIR        ENOTDIR
+#define NEWFS_ERROR_NOTEMPTY      ENOTEMPTY
+#define NEWFS_ERROR_FBIG          EFBIG
 
 #define MAX_FILE_NAME           128
-#define NEWFS_DATA_PER_FILE       4
+#define NEWFS_EXTENT_DIRECT       4     // inode中直接记录的extent数，其后的extent存放在一级/二级间接块中
+#define NEWFS_BLK_NONE            (-1)  // 未分配的间接块
+#define NEWFS_INLINE_SZ           192   // 内联数据字节数，不超过该大小且未分配数据块的文件内容直接存放在inode中
+#define NEWFS_SLAB_CHUNK_SZ       16384 // slab每次向系统申请的大块字节数
+#define NEWFS_SLAB_ALIGN          16    // slab对象对齐
+#define NEWFS_NAME_CLASSES        4     // 名字按16/32/64/128字节分级存放
 #define NEWFS_DEFAULT_PERM        0777
 
 #define NEWFS_IOC_MAGIC           'S'
@@ -45,13 +54,46 @@ typedef enum file_type {
 
 #define NEWFS_FLAG_BUF_DIRTY      0x1
 #define NEWFS_FLAG_BUF_OCCUPY     0x2
+#define NEWFS_FLAG_BUF_LOGGED     0x4   // 内容已提交到日志，尚未写回原位置
+#define NEWFS_FLAG_BUF_LOADING    0x8   // 预读正在读入，已登记块号但内容无效，其他线程等待 io_done
+
+#define NEWFS_INDEX_MIN_CAP       8     // 目录哈希索引最小容量
+#define NEWFS_INDEX_TOMB          ((struct newfs_dentry *)1)    // 哈希索引中已删除的槽位
+#define NEWFS_SLOTS_MIN           8     // 目录槽位数组的最小容量
+
+#define NEWFS_FLAG_INODE_DIRTY    0x1   // inode本身需要回写
+#define NEWFS_FLAG_INODE_LISTED   0x2   // inode已在super的脏链表上
 
 
 #define NEWFS_SUPER_BLKS          1     // 超级块
-#define NEWFS_MAP_DATA_BLKS       1     // 最多只有4096个数据块，位图大小为 4096/8 = 512B，所以data位图只需要1块
-#define NEWFS_MAP_INODE_BLKS      1     // 一个inode可对应一个或多个数据块，因此inode位图只需要1块
-#define NEWFS_INODE_NUM           256
-#define NEWFS_DATA_NUM            2048
+#define NEWFS_INODE_RATIO         16384 // 默认每16KB设备空间配一个inode，4MB设备为256个，mkfs.newfs可用--inode_ratio调整
+#define NEWFS_INODE_NUM           256   // 旧版本超级块未记录容量时的inode数
+#define NEWFS_DATA_NUM            2048  // 旧版本超级块未记录容量时的数据块数
+#define NEWFS_GROUP_INO_ALIGN     64    // 每个块组的inode数按64对齐，块组在内存位图中从整字开始
+#define NEWFS_JOURNAL_AUTO        -1    // 日志区大小按设备大小推算：设备块数的1/32，限制在64..1024块
+#define NEWFS_JOURNAL_MIN_BLKS    64
+#define NEWFS_JOURNAL_MAX_BLKS    1024
+#define NEWFS_JOURNAL_DESC        1     // 描述块：事务中各块的原位置
+#define NEWFS_JOURNAL_COMMIT      2     // 提交块：事务完整写入的标志
+#define NEWFS_JOURNAL_CKPT_PCT    75    // 日志用去超过该百分比时回写线程做检查点
+
+#define NEWFS_BCACHE_BLKS         64    // 块缓存默认容量（块数），可通过 --cache_blks 调整
+#define NEWFS_IOV_MAX_RUN         32    // 一次preadv/pwritev最多的段数
+#define NEWFS_DEV_BATCH           128   // 一次批量提交（newfs_dev_submit）最多的块数
+
+#define NEWFS_DCACHE_MAX          4096  // 路径缓存最多缓存的路径数，满后整体清空
+
+#define NEWFS_WB_INTERVAL_MS      5000  // 回写线程默认唤醒周期，--wb_interval_ms，0表示不启动回写线程
+#define NEWFS_WB_EXPIRE_MS        30000 // 脏数据默认最长驻留时间，--wb_expire_ms
+#define NEWFS_WB_DIRTY_KB         256   // 脏数据默认阈值，--wb_dirty_kb，超过后立即回写
+
+#define NEWFS_FILE_ALIGN_MAX      4096  // O_DIRECT中转缓冲的对齐，不小于常见的扇区大小
+#define NEWFS_URING_DEPTH         64    // io_uring后端默认的在途请求上限，--uring_depth
+#define NEWFS_URING_DEPTH_MAX     4096
+
+#define NEWFS_RA_KB               32    // 预读窗口默认上限，--ra_kb，0表示不预读；块缓存至少为它的四倍
+#define NEWFS_RA_MIN_BLKS         4     // 识别为顺序读后的初始预读窗口（块数），此后每次翻倍
+#define NEWFS_RA_QUEUE            16    // 预读线程的请求队列长度，满时丢弃新请求
 
 /**********************************************************
  * SECTION: Macro Function
@@ -61,15 +103,36 @@ typedef enum file_type {
 #define NEWFS_DRIVER()                    (newfs_super.fd)             
 #define NEWFS_BLK_SZ()                    (newfs_super.sz_blk)     
 #define NEWFS_INODE_SZ()                  (sizeof(struct newfs_inode_d))    // 一个inode_d的大小
+#define NEWFS_DENTRY_REC_LEN(name_len)    NEWFS_ROUND_UP(((int)sizeof(struct newfs_dentry_d) + (name_len)), 4)  // 名字长为name_len的目录项记录长度
+#define NEWFS_DIRTY_BLK_MASK(blk)         (1u << ((blk) < UINT32_BITS - 1 ? (blk) : UINT32_BITS - 1))  // 第31个及以后的目录块共用最高位
+#define NEWFS_EXTENT_PER_BLK()            ((int)(NEWFS_BLK_SZ() / sizeof(struct newfs_extent)))  // 每个间接块的extent数
+#define NEWFS_PTR_PER_BLK()               ((int)(NEWFS_BLK_SZ() / sizeof(int)))       // 二级间接块的指针数
+#define NEWFS_EXTENT_MAX()                (NEWFS_EXTENT_DIRECT + NEWFS_EXTENT_PER_BLK() * (1 + NEWFS_PTR_PER_BLK()))
 
 #define NEWFS_ROUND_DOWN(value, round)    (value % round == 0 ? value : (value / round) * round)
 #define NEWFS_ROUND_UP(value, round)      (value % round == 0 ? value : (value / round + 1) * round)
 
 #define NEWFS_BLKS_SZ(blks)               (blks * NEWFS_BLK_SZ())
-#define NEWFS_ASSIGN_FNAME(pnfs_dentry, _fname) memcpy(pnfs_dentry->name, _fname, strlen(_fname))
 
-#define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + ino * NEWFS_BLK_SZ())
-#define NEWFS_DATA_OFS(ino)               (newfs_super.data_offset + ino * NEWFS_BLK_SZ())
+#define NEWFS_INO_GROUP(ino)              ((ino) / newfs_super.ino_per_group)      // inode所在块组
+#define NEWFS_DATA_GROUP(blk)             ((blk) / newfs_super.data_per_group)     // 数据块所在块组
+#define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + NEWFS_INO_GROUP(ino) * newfs_super.group_sz + \
+                                           ((ino) % newfs_super.ino_per_group) * NEWFS_INODE_SZ())
+#define NEWFS_DATA_OFS(blk)               (newfs_super.data_offset + NEWFS_DATA_GROUP(blk) * newfs_super.group_sz + \
+                                           ((blk) % newfs_super.data_per_group) * NEWFS_BLK_SZ())
+
+/**
+ * 锁的顺序：命名空间锁 newfs_super.lock -> inode->lock -> load_lock -> 位图锁 -> 块缓存锁 -> 设备锁（ddriver后端的设备锁、uring后端的环） -> 回写锁，slab锁、预读锁不嵌套其他锁，
+ * 路径缓存锁只在 newfs_dcache_* 内部持有。只读操作持有命名空间读锁，创建/删除/重命名及刷写持有写锁
+ */
+#define NEWFS_RDLOCK()                    pthread_rwlock_rdlock(&newfs_super.lock)
+#define NEWFS_WRLOCK()                    pthread_rwlock_wrlock(&newfs_super.lock)
+#define NEWFS_UNLOCK()                    pthread_rwlock_unlock(&newfs_super.lock)
+#define NEWFS_INODE_RDLOCK(pinode)        pthread_rwlock_rdlock(&(pinode)->lock)
+#define NEWFS_INODE_WRLOCK(pinode)        pthread_rwlock_wrlock(&(pinode)->lock)
+#define NEWFS_INODE_UNLOCK(pinode)        pthread_rwlock_unlock(&(pinode)->lock)
+#define NEWFS_BCACHE_LOCK()               pthread_mutex_lock(&newfs_super.bcache.lock)
+#define NEWFS_BCACHE_UNLOCK()             pthread_mutex_unlock(&newfs_super.bcache.lock)
 
 #define NEWFS_IS_DIR(pinode)              (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_FILE(pinode)              (pinode->dentry->ftype == NEWFS_REG_FILE)
@@ -78,6 +141,182 @@ typedef enum file_type {
 
 struct custom_options {
 	const char*        device;
+	int                cache_blks;                  // 块缓存容量（块数）
+	int                wb_interval_ms;              // 回写线程唤醒周期
+	int                wb_expire_ms;                // 脏数据最长驻留时间
+	int                wb_dirty_kb;                 // 脏数据阈值
+	int                no_buf_io;                   // --no_buf_io：不注册read_buf/write_buf
+	int                lowlevel;                    // --lowlevel：使用按inode号访问的低层接口
+	int                lazy_mount;                  // --lazy_mount：挂载时只读超级块，位图与根目录首次访问时读入
+	int                ra_kb;                       // 预读窗口上限（KB）
+	const char*        backend;                     // --backend：块设备后端，ddriver（默认）、file或uring
+	int                direct;                      // --direct：file/uring后端以O_DIRECT打开
+	int                uring_depth;                 // --uring_depth：io_uring后端的队列深度
+};
+
+struct newfs_dev_req {                              // 批量提交中的一段连续访问
+    off_t              offset;                      // 设备上的字节偏移
+    uint8_t**          bufs;                        // 每块的内存地址
+    int                cnt;                         // 块数
+    boolean            is_write;
+};
+
+struct newfs_dev_ops {                              // 块设备后端，见 newfs_dev.c
+    const char*        name;
+    int                (*open)(const char* path, boolean is_direct, int depth);  // 返回设备句柄，失败返回错误码；depth为0取默认
+    int                (*pread)(int fd, uint8_t** bufs, int cnt, int sz, off_t offset);  // 设备上从offset起连续cnt段、每段sz字节，第i段读入bufs[i]
+    int                (*pwrite)(int fd, uint8_t** bufs, int cnt, int sz, off_t offset); // 同上，写出
+    int                (*submit)(int fd, struct newfs_dev_req* reqs, int n, int sz);     // 批量访问互不重叠的n段，全部完成后返回
+    int                (*register_mem)(int fd, uint8_t* base, size_t len);              // 登记常驻的IO内存，base为NULL时撤销；可为NULL
+    int                (*flush)(int fd);            // 此前写入的数据落盘
+    int                (*splice_fd)(int fd);        // 可直接读出块内容、交给FUSE splice的文件描述符，不支持返回-1；可为NULL
+    int                (*size)(int fd);             // 设备字节数
+    int                (*io_size)(int fd);          // IO单位
+    void               (*close)(int fd);
+};
+
+struct newfs_buf {                                  // 块缓存中的一个缓冲块
+    int                blkno;                       // 对应的磁盘块号
+    int                flag;                        // NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_OCCUPY | NEWFS_FLAG_BUF_LOGGED | NEWFS_FLAG_BUF_LOADING
+    int                jblk;                        // 最近一次提交时在日志区中的位置
+    uint8_t*           data;                        // 块内容，大小为 NEWFS_BLK_SZ()
+    struct newfs_buf*  hash_next;                   // 哈希桶链
+    struct newfs_buf*  lru_prev;                    // LRU 链，靠近头部为最近使用
+    struct newfs_buf*  lru_next;
+    struct newfs_buf*  extra_next;                  // 临时增加的缓冲块链
+};
+
+struct newfs_iovec {                                // 分散/聚集IO的一段
+    int                offset;                      // 磁盘偏移
+    uint8_t*           base;                        // 内存地址
+    int                size;                        // 长度
+};
+
+struct newfs_bcache {
+    struct newfs_buf*  bufs;                        // 所有缓冲块，数量固定
+    int                nbufs;
+    struct newfs_buf*  extra;                       // 提交期间脏块占满缓存时临时增加的缓冲块，提交后释放
+    int                nextra;
+    uint8_t*           arena;                       // 缓冲块内存池，按IO单位对齐，挂载时一次分配
+    struct newfs_buf** sorted;                      // 刷写时按块号排序的脏块，容量 nbufs + nextra
+    struct newfs_buf** hash;                        // 块号 -> 缓冲块
+    int                hash_sz;
+    struct newfs_buf*  lru_head;                    // 最近使用
+    struct newfs_buf*  lru_tail;                    // 最久未使用，优先淘汰
+
+    int                hits;                        // 命中次数
+    int                misses;                      // 未命中次数（需要读设备）
+    int                writebacks;                  // 脏块回写次数
+    int                prefetched;                  // 预读读入的块数
+    pthread_mutex_t    lock;                        // 保护缓存结构，调用者在使用返回的缓冲块期间持有
+    pthread_cond_t     io_done;                     // 预读的一批块读入完成
+};
+
+struct newfs_dcache_entry {                         // 路径缓存项
+    char*              path;                        // 完整路径
+    uint32_t           hash;
+    struct newfs_dentry* dentry;                    // newfs_lookup的返回值
+    boolean            is_find;                     // FALSE为负项，dentry为最深的已存在祖先
+    int                gen;                         // 负项生成时的 neg_gen
+    struct newfs_dcache_entry* next;                // 哈希桶链
+};
+
+struct newfs_dcache {                               // 完整路径 -> dentry
+    struct newfs_dcache_entry** buckets;
+    int                nbuckets;
+    int                count;
+    int                neg_gen;                     // 创建/删除/重命名时递增，使所有负项失效
+    int                hits;
+    int                misses;
+    pthread_mutex_t    lock;                        // 查找也会插入和统计，只读操作之间同样需要互斥
+};
+
+struct newfs_bitmap {
+    uint64_t*          words;                       // 按64位字访问的内存位图，指向 map_inode / map_data
+    uint64_t*          summary;                     // 汇总层，第w位表示words[w]已满
+    int                nbits;                       // 有效位数，max_ino / max_data
+    int                nwords;
+    int                hint;                        // next-fit：上次分配所在的字
+    int                used;                        // 已占用位数
+    uint8_t*           map_dirty;                   // 每个块组的位图是否需要回写
+    int                group_bits;                  // 每个块组的位数，块组g占 [g*group_bits, (g+1)*group_bits)
+    int                groups;                      // 块组数
+    int*               group_used;                  // 每个块组已占用的位数
+    boolean            is_loaded;                   // 内存位图与汇总层是否已建立，延迟挂载时首次分配/释放才读入
+    int                map_offset;                  // 块组0的位图在磁盘上的偏移
+    int                map_stride;                  // 相邻块组位图的距离（字节）
+    uint64_t*          pinned;                      // 本回写周期内释放、暂不重新分配的位，NULL表示不保留
+    uint64_t*          pinned_old;                  // 上一回写周期内释放的位
+    int                pinned_cnt;                  // 两者合计的位数
+    pthread_mutex_t    lock;                        // 保护以上字段，inode位图与数据位图互不影响
+};
+
+struct newfs_slab {                                 // 定长对象分配器，卸载时按大块整体释放
+    int                obj_sz;                      // 对象大小，按NEWFS_SLAB_ALIGN对齐
+    int                per_chunk;                   // 每个大块可切出的对象数
+    void*              free_list;                   // 已归还的对象，首个指针字段串成链
+    uint8_t*           chunks;                      // 已申请的大块，块首存放下一块的地址
+    int                carved;                      // 当前大块已切出的对象数
+    pthread_mutex_t    lock;
+};
+
+struct newfs_journal {                              // 元数据日志
+    boolean            is_enabled;                  // 超级块记录了日志区时启用
+    int                blkno;                       // 日志区第一块（日志超级块）的块号
+    int                blks;                        // 日志区块数
+    int                head;                        // 下一个事务写入的位置（相对日志区）
+    uint32_t           seq;                         // 下一个事务的序号
+    uint32_t           syncs;                       // 完整提交（含全部脏元数据）的次数，组提交据此判断
+    uint8_t*           logged;                      // 每个设备块一位，是否出现在未做检查点的事务中
+    uint8_t*           hdrs;                        // 各描述块与提交块，ndesc + 1 块，按IO单位对齐
+    uint8_t**          vec;                         // 一次顺序写的各块地址：描述块、记录块 ...、提交块
+    int                cap;                         // 一个事务最多记录的块数，空日志恰好容纳
+    int                ndesc;                       // 记录cap块的事务所需的描述块数
+    boolean            is_open;                     // 正在把脏元数据写入块缓存，提交前不能只提交其中一部分
+    int                commits;                     // 写入日志的事务数
+    int                logged_blks;                 // 写入日志的块数
+    int                checkpoints;                 // 检查点次数
+    int                joins;                       // 被其他线程的提交顺带完成的fsync次数
+};
+
+struct newfs_wb {                                   // 后台回写
+    pthread_t          tid;
+    pthread_cond_t     cond;                        // 与 lock 配合使用
+    pthread_mutex_t    lock;                        // 保护脏数据统计和super的脏链表
+    boolean            is_running;
+    int                interval_ms;
+    int                expire_ms;
+    int                dirty_thresh;                // 脏数据阈值（字节）
+    int                dirty_bytes;                 // 上次刷写以来新增的脏元数据（字节）
+    int                dirty_blks;                  // 下一次提交至多写入日志的块数
+    long               dirty_since_ms;              // 最早一笔未刷写的脏数据产生时间，0表示干净
+    int                flushes;                     // 回写线程发起的刷写次数
+    int                throttles;                   // 修改操作因脏块过多先行刷写的次数
+};
+
+struct newfs_ra_state {                             // 每个打开文件的预读状态，存放在fi->fh
+    int                next;                        // 顺序读时下一次读的起始逻辑块
+    int                window;                      // 当前预读窗口（块数），0表示未识别为顺序读
+    int                ra_end;                      // 已发起预读的范围终点（逻辑块，不含）
+};
+
+struct newfs_ra_req {                               // 一次预读请求
+    int                ino;
+    int                lblk;                        // 起始逻辑块
+    int                cnt;                         // 块数
+};
+
+struct newfs_ra {                                   // 预读线程
+    pthread_t          tid;
+    pthread_cond_t     cond;                        // 与 lock 配合使用
+    pthread_mutex_t    lock;                        // 保护请求队列和各打开文件的预读状态
+    boolean            is_running;
+    int                max_blks;                    // 预读窗口上限（块数），0表示不预读
+    struct newfs_ra_req queue[NEWFS_RA_QUEUE];      // 环形队列
+    int                qhead;
+    int                qcnt;
+    int                submitted;                   // 发起的预读请求数
+    int                dropped;                     // 队列满而丢弃的请求数
 };
 
 struct newfs_super {
@@ -89,6 +328,7 @@ struct newfs_super {
 
     struct newfs_dentry*     root_dentry;           // 根目录dentry
     boolean            is_mounted;
+    long               mount_us;                    // newfs_mount耗时（微秒）
 
     int                sz_io;                       // 512KB
     int                sz_disk;                     // 4MB
@@ -96,17 +336,48 @@ struct newfs_super {
     int                sz_usage;                    // 用于存储ioctl相关信息
 
     uint8_t*           map_inode;                   // inode位图
-    int                map_inode_blks;              // inode位图占用的块数
-    int                map_inode_offset;            // inode位图在磁盘上的偏移
+    int                map_inode_blks;              // 每个块组的inode位图占用的块数
+    int                map_inode_offset;            // 块组0的inode位图在磁盘上的偏移
     
     uint8_t*           map_data;                    // data位图
-    int                map_data_blks;               // data位图占用的块数
-    int                map_data_offset;             // data位图在磁盘上的偏移
+    int                map_data_blks;               // 每个块组的data位图占用的块数
+    int                map_data_offset;             // 块组0的data位图在磁盘上的偏移
+
+    struct newfs_bitmap bm_inode;                   // inode分配器
+    struct newfs_bitmap bm_data;                    // 数据块分配器
+
+    uint8_t*           map_inode_dirty;             // 每个块组的inode位图是否需要回写
+    uint8_t*           map_data_dirty;              // 每个块组的data位图是否需要回写
+    boolean            is_super_dirty;              // 超级块是否需要回写
+    struct newfs_inode* dirty_inodes;               // 脏inode链表
+    struct newfs_dentry** ino_dentry;               // ino -> 已读入inode的dentry，供低层接口按inode号访问
+    int                dir_opens;                   // 打开的目录句柄数，为0时才压缩目录的空槽
+    unsigned long*     nlookup;                     // 低层接口下内核对每个inode号的lookup计数，不为0的号不重新分配；高层接口为NULL
+    struct newfs_slab  slab_dentry;                 // 内存dentry
+    struct newfs_slab  slab_inode;                  // 内存inode
+    struct newfs_slab  slab_name[NEWFS_NAME_CLASSES];  // 名字，第c级存放不超过16<<c字节（含结尾0）的名字
 
     int                inode_offset;          // 第一个索引节点在磁盘上的偏移
     int                data_offset;           // 第一个数据块在磁盘上的偏移
+    int                groups;                // 块组数
+    int                ino_per_group;         // 每个块组的inode数
+    int                data_per_group;        // 每个块组的数据块数，最后一个块组可能不满
+    int                group_sz;              // 相邻块组的距离（字节）
+
+    struct newfs_bcache bcache;               // 块缓存
+    struct newfs_wb    wb;                    // 后台回写
+    struct newfs_journal journal;             // 元数据日志
+    struct newfs_ra    ra;                    // 顺序预读
+    struct newfs_dcache dcache;               // 路径缓存
+    pthread_rwlock_t   lock;                  // 命名空间锁：dentry树、目录索引和路径缓存的结构
+    pthread_mutex_t    load_lock;             // 只读操作中按需读入inode、建立目录索引
+    const struct newfs_dev_ops* dev;          // 块设备后端
 
+};
 
+struct newfs_extent {                               // 一段连续的数据块，内存与磁盘格式相同
+    int                start;                       // 起始数据块号
+    int                len;                         // 块数
 };
 
 struct newfs_inode {
@@ -116,30 +387,47 @@ struct newfs_inode {
     int                 dir_cnt;                                // 目录项数量
     struct newfs_dentry*dentry;                                 // 指向该inode的dentry
     struct newfs_dentry*dentrys;                                // 所有目录项  
-    int                 block_pointer[NEWFS_DATA_PER_FILE];     // 数据块指针
+    struct newfs_extent*extents;                                // 按逻辑顺序排列的extent，首尾相接覆盖整个文件
+    int                 ext_cnt;                                // extent数量
+    int                 ext_cap;                                // extents数组容量
+    int                 blks;                                   // 已分配的数据块数，即所有extent长度之和
+    uint64_t            ext_hint;                               // newfs_bmap上次命中的extent：高32位为其起始逻辑块号，低32位为下标，并发读者整体原子读写
+    int                 ext_dirty_from;                         // 自该下标起的extent需要写回间接块
+    int                 ext_ind;                                // 一级间接块，存放extent
+    int                 ext_dind;                               // 二级间接块，存放一级间接块的块号
+    int*                dind_blks;                              // 二级间接块的内容
+    int                 dind_cnt;                               // dind_blks中有效的块数
+    boolean             is_dind_dirty;                          // 二级间接块需要回写
+    uint8_t             inline_data[NEWFS_INLINE_SZ];           // 文件：blks为0时文件内容存放于此，随inode回写
+
+    struct newfs_dentry** index;                                // 目录：按名字哈希的开放寻址索引，首次查找时建立
+    int                 index_cap;                              // 索引容量，2的幂
+    int                 index_used;                             // 已占用槽位（含删除标记）
+    struct newfs_dentry** slots;                                // 目录：按readdir槽位排列的目录项，删除留下的空槽为NULL
+    int                 slot_cnt;                               // 已用到的槽位数（含空槽）
+    int                 slot_cap;
+    int                 slot_hint;                              // 此前的槽位都已占用，新目录项从这里找空槽
+
+    int                 flag;                                   // NEWFS_FLAG_INODE_*
+    uint32_t            dirty_blks;                             // 目录：第i位表示第i个目录块需要回写，见NEWFS_DIRTY_BLK_MASK
+    int*                dir_free;                               // 目录：每个目录块的剩余字节数
+    struct newfs_inode* dirty_next;                             // super脏链表
+    pthread_rwlock_t    lock;                                   // 读文件持读锁，写文件、改变大小持写锁
 };
 
 struct newfs_dentry {
-    char     name[MAX_NAME_LEN];
+    char*    name;                              // 名字，存放在名字slab中，见newfs_name_dup
     uint32_t ino;
     /* TODO: Define yourself */
     struct newfs_dentry*      parent;           // 父亲Inode的dentry
     struct newfs_dentry*      brother;          // 兄弟
     struct newfs_inode* inode;                  // 指向inode    
     FILE_TYPE           ftype;
+    int                 pos;                    // 在父目录中的槽位，readdir的偏移为槽位+1，目录项存在期间不变
+    uint32_t            hash;                   // 名字哈希，加入目录时计算
+    int                 blk;                    // 记录所在的目录块（目录内逻辑块号）
 };
 
-static inline struct newfs_dentry* new_dentry(char * fname, FILE_TYPE ftype) {
-    struct newfs_dentry * dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry)); /* dentry 在内存空间也是随机分配 */
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NEWFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;
-    return dentry;                                            
-}
 
 
 
@@ -150,16 +438,40 @@ struct newfs_super_d {
     uint32_t           magic_num;                   // 幻数，用于识别文件系统
     int                sz_usage;
 
-    int                map_inode_blks;              // inode位图占用的块数
-    int                map_inode_offset;            // inode位图在磁盘上的偏移
+    int                map_inode_blks;              // 每个块组的inode位图占用的块数
+    int                map_inode_offset;            // 块组0的inode位图在磁盘上的偏移
 
-    int                map_data_blks;               // data位图占用的块数
-    int                map_data_offset;             // data位图在磁盘上的偏移
+    int                map_data_blks;               // 每个块组的data位图占用的块数
+    int                map_data_offset;             // 块组0的data位图在磁盘上的偏移
 
     int                inode_offset;                // 索引节点在磁盘上的偏移
     int                data_offset;                 // 数据块在磁盘上的偏移
 
+    int                max_ino;                     // 最多支持的文件数
+    int                max_data;                    // 最大数据块数
+
+    int                groups;                      // 块组数，0表示未分组的旧布局
+    int                ino_per_group;               // 每个块组的inode数
+    int                data_per_group;              // 每个块组的数据块数
+    int                group_blks;                  // 每个块组占用的块数
+
+    int                journal_offset;              // 日志区在磁盘上的偏移，位于设备末尾
+    int                journal_blks;                // 日志区块数，0表示没有日志
+};
+
+struct newfs_journal_sb {                           // 日志超级块，日志区第一块
+    uint32_t           magic;
+    uint32_t           seq;                         // start处事务的序号
+    int                start;                       // 第一个需要重放的事务（相对日志区），只在检查点时更新
+};
 
+struct newfs_journal_hdr {                          // 描述块与提交块
+    uint32_t           magic;
+    uint32_t           type;                        // NEWFS_JOURNAL_DESC / NEWFS_JOURNAL_COMMIT
+    uint32_t           seq;                         // 事务序号
+    int                cnt;                         // 描述块：本描述块记录的块数；提交块：事务中的块数
+    uint32_t           csum;                        // 提交块：描述块与各记录块的校验和
+    int                blknos[];                    // 描述块：各记录块的原位置（块号）
 };
 
 struct newfs_inode_d {  //索引节点
@@ -168,14 +480,21 @@ struct newfs_inode_d {  //索引节点
     int                link;                                // 链接数
     FILE_TYPE          ftype;                               // 文件类型（目录类型、普通文件类型）
     int                dir_cnt;                             // 如果是目录类型文件，下面有几个目录项
-    int                block_pointer[NEWFS_DATA_PER_FILE];  // 数据块指针（可固定分配）
+    int                ext_cnt;                             // extent数量
+    struct newfs_extent extents[NEWFS_EXTENT_DIRECT];        // 数据块extent
+    int                ext_ind;                             // 一级间接块，存放第NEWFS_EXTENT_DIRECT个起的extent
+    int                ext_dind;                            // 二级间接块，存放更多一级间接块的块号
+    uint8_t            inline_data[NEWFS_INLINE_SZ];        // 内联数据，补齐inode_d为256B
 };  
 
-struct newfs_dentry_d  /*目录项*/
+struct newfs_dentry_d  /*目录项，变长记录，在目录块内依次紧排，rec_len为0处结束*/
 {
-    char               fname[MAX_FILE_NAME];          // 指向的ino文件名
-    FILE_TYPE          ftype;                         // 指向的ino文件类型
     int                ino;                           // 指向的ino号
+    uint32_t           hash;                          // 名字哈希，见newfs_hash_name，读入时不必重算
+    uint16_t           rec_len;                       // 本记录长度，含名字并按4字节对齐
+    uint8_t            name_len;                      // 名字长度，不含结尾0
+    uint8_t            ftype;                         // 指向的ino文件类型
+    char               fname[];                       // 名字，不以0结尾
 };  
 
 
@@ -0,0 +1,223 @@
+#include "../../include/newfs.h"
+
+/**
+ * mkfs.newfs: 按设备大小格式化newfs
+ *
+ *   mkfs.newfs [--inode_ratio=字节数] [--journal_blks=块数] [--layout=布局文件]
+ *              [--backend=ddriver|file|uring] [--direct] [设备路径]
+ *
+ * 设备路径默认为 $HOME/ddriver，--backend/--direct 与挂载时的同名选项相同。
+ * 每个块组的两张位图和inode表（块组0连同超级块）在内存中按段拼好，
+ * 按段顺序写出，数据区不写。日志区只写第一块的日志超级块，--journal_blks 默认按设备大小推算，
+ * 0表示不要日志。--layout 写出与之对应的布局文件，供tests/checkbm使用。
+ */
+
+#define MKFS_CHUNK_BLKS           64    // 每段拼装的块数
+
+struct mkfs_options {
+    const char*        device;
+    const char*        layout;
+    const char*        backend;
+    int                direct;
+    int                inode_ratio;
+    int                journal_blks;
+};
+
+static const struct newfs_dev_ops* mkfs_dev;        /* 块设备后端 */
+
+/**
+ * @brief 将位于设备偏移ofs处的len字节中落在当前段内的部分复制进段
+ *
+ * @param chunk 段缓冲
+ * @param chunk_ofs 段在设备上的偏移
+ * @param chunk_sz 段大小
+ * @param ofs
+ * @param src
+ * @param len
+ */
+static void mkfs_put(uint8_t* chunk, int chunk_ofs, int chunk_sz, int ofs, const void* src, int len) {
+    int from = ofs > chunk_ofs ? ofs : chunk_ofs;
+    int to   = ofs + len < chunk_ofs + chunk_sz ? ofs + len : chunk_ofs + chunk_sz;
+
+    if (from < to) {
+        memcpy(chunk + from - chunk_ofs, (const uint8_t *)src + from - ofs, to - from);
+    }
+}
+/**
+ * @brief 写出一段元数据区 [from, to)：超级块、位图（根目录占用0号inode）、inode表和日志超级块中落在其中的部分
+ *
+ * @param fd
+ * @param super_d
+ * @param from
+ * @param to
+ * @param sz_blk
+ * @return int
+ */
+static int mkfs_write_range(int fd, struct newfs_super_d* super_d, int from, int to, int sz_blk) {
+    struct newfs_inode_d root;
+    struct newfs_journal_sb jsb;
+    uint8_t  root_bit  = 0x1;
+    int      chunk_max = MKFS_CHUNK_BLKS * sz_blk;
+    int      chunk_sz, ofs;
+    uint8_t* chunk;
+
+    memset(&root, 0, sizeof(struct newfs_inode_d));
+    root.ino      = NEWFS_ROOT_INO;
+    root.link     = 1;
+    root.ftype    = NEWFS_DIR;
+    root.ext_ind  = NEWFS_BLK_NONE;
+    root.ext_dind = NEWFS_BLK_NONE;
+    jsb.magic     = NEWFS_JOURNAL_MAGIC;
+    jsb.seq       = (uint32_t)time(NULL);           /* 与挂载时就地格式化一致，旧日志中的残留事务不会被误认 */
+    jsb.start     = 1;
+
+    chunk = (uint8_t *)malloc(chunk_max);
+    if (chunk == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (ofs = from; ofs < to; ofs += chunk_sz) {
+        chunk_sz = to - ofs < chunk_max ? to - ofs : chunk_max;
+        memset(chunk, 0, chunk_sz);
+        mkfs_put(chunk, ofs, chunk_sz, NEWFS_SUPER_OFS, super_d, sizeof(struct newfs_super_d));
+        mkfs_put(chunk, ofs, chunk_sz, super_d->map_inode_offset, &root_bit, sizeof(uint8_t));
+        mkfs_put(chunk, ofs, chunk_sz, super_d->inode_offset + NEWFS_ROOT_INO * NEWFS_INODE_SZ(),
+                 &root, sizeof(struct newfs_inode_d));
+        if (super_d->journal_blks > 0) {
+            mkfs_put(chunk, ofs, chunk_sz, super_d->journal_offset, &jsb, sizeof(struct newfs_journal_sb));
+        }
+        if (mkfs_dev->pwrite(fd, &chunk, 1, chunk_sz, ofs) != NEWFS_ERROR_NONE) {
+            free(chunk);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    free(chunk);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 写出元数据：块组0连同超级块一起写，其余块组各seek一次，写出位图和inode表，最后写日志超级块
+ *
+ * @param fd
+ * @param super_d
+ * @param sz_blk
+ * @return int
+ */
+static int mkfs_write_meta(int fd, struct newfs_super_d* super_d, int sz_blk) {
+    int meta_sz  = super_d->data_offset - super_d->map_inode_offset;   /* 每个块组的元数据区 */
+    int group_sz = super_d->group_blks * sz_blk;
+    int g, base, ret;
+
+    if ((ret = mkfs_write_range(fd, super_d, NEWFS_SUPER_OFS, super_d->data_offset,
+                                sz_blk)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    for (g = 1; g < super_d->groups; g++) {
+        base = super_d->map_inode_offset + g * group_sz;
+        if ((ret = mkfs_write_range(fd, super_d, base, base + meta_sz, sz_blk)) != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    if (super_d->journal_blks > 0) {
+        return mkfs_write_range(fd, super_d, super_d->journal_offset, super_d->journal_offset + sz_blk,
+                                sz_blk);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 解析命令行
+ *
+ * @param argc
+ * @param argv
+ * @param options
+ * @return int
+ */
+static int mkfs_parse(int argc, char** argv, struct mkfs_options* options) {
+    static char device[4096];
+    int i;
+
+    snprintf(device, sizeof(device), "%s/ddriver", getenv("HOME") ? getenv("HOME") : ".");
+    options->device      = device;
+    options->layout      = NULL;
+    options->backend     = NULL;
+    options->direct      = FALSE;
+    options->inode_ratio = NEWFS_INODE_RATIO;
+    options->journal_blks = NEWFS_JOURNAL_AUTO;
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--inode_ratio=", 14) == 0) {
+            options->inode_ratio = atoi(argv[i] + 14);
+        }
+        else if (strncmp(argv[i], "--journal_blks=", 15) == 0) {
+            options->journal_blks = atoi(argv[i] + 15);
+        }
+        else if (strncmp(argv[i], "--layout=", 9) == 0) {
+            options->layout = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--backend=", 10) == 0) {
+            options->backend = argv[i] + 10;
+        }
+        else if (strcmp(argv[i], "--direct") == 0) {
+            options->direct = TRUE;
+        }
+        else if (argv[i][0] != '-') {
+            options->device = argv[i];
+        }
+        else {
+            return -NEWFS_ERROR_INVAL;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+int main(int argc, char** argv) {
+    struct mkfs_options  options;
+    struct newfs_super_d super_d;
+    int    fd, sz_disk, sz_io, sz_blk;
+    int    ret;
+
+    if (mkfs_parse(argc, argv, &options) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "usage: %s [--inode_ratio=BYTES] [--journal_blks=N] [--layout=FILE] "
+                "[--backend=ddriver|file|uring] [--direct] [DEVICE]\n", argv[0]);
+        return 1;
+    }
+    if ((mkfs_dev = newfs_dev_lookup(options.backend)) == NULL) {
+        fprintf(stderr, "mkfs.newfs: unknown backend %s\n", options.backend);
+        return 1;
+    }
+    fd = mkfs_dev->open(options.device, options.direct, 0);
+    if (fd < 0) {
+        fprintf(stderr, "mkfs.newfs: cannot open %s\n", options.device);
+        return 1;
+    }
+    sz_disk = mkfs_dev->size(fd);
+    sz_io   = mkfs_dev->io_size(fd);
+    sz_blk = 2 * sz_io;                              /* 与newfs_mount一致 */
+
+    if ((ret = newfs_layout_calc(sz_disk, sz_blk, options.inode_ratio, options.journal_blks,
+                                 &super_d)) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.newfs: device of %d bytes cannot hold inode ratio %d with %d journal blocks\n",
+                sz_disk, options.inode_ratio, options.journal_blks);
+        mkfs_dev->close(fd);
+        return 1;
+    }
+    if ((ret = mkfs_write_meta(fd, &super_d, sz_blk)) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.newfs: write failed (%d)\n", ret);
+        mkfs_dev->close(fd);
+        return 1;
+    }
+    if (mkfs_dev->flush(fd) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.newfs: flush failed\n");
+        mkfs_dev->close(fd);
+        return 1;
+    }
+    mkfs_dev->close(fd);
+
+    printf("%s: %d bytes, block %d B, %d inodes, %d data blocks, %d groups of %d blocks, "
+           "data starts at block %d, %d journal blocks\n",
+           options.device, sz_disk, sz_blk, super_d.max_ino, super_d.max_data,
+           super_d.groups, super_d.group_blks, super_d.data_offset / sz_blk, super_d.journal_blks);
+    if (options.layout != NULL &&
+        newfs_layout_write(options.layout, &super_d, sz_blk) != NEWFS_ERROR_NONE) {
+        fprintf(stderr, "mkfs.newfs: cannot write %s\n", options.layout);
+        return 1;
+    }
+    return 0;
+}
@@ -10,11 +10,27 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--wb_interval_ms=%d", wb_interval_ms),
+	OPTION("--wb_expire_ms=%d", wb_expire_ms),
+	OPTION("--wb_dirty_kb=%d", wb_dirty_kb),
+	OPTION("--no_buf_io", no_buf_io),
+	OPTION("--lowlevel", lowlevel),
+	OPTION("--lazy_mount", lazy_mount),
+	OPTION("--ra_kb=%d", ra_kb),
+	OPTION("--backend=%s", backend),
+	OPTION("--direct", direct),
+	OPTION("--uring_depth=%d", uring_depth),
 	FUSE_OPT_END
 };
 
 struct custom_options newfs_options;			 /* 全局选项 */
-struct newfs_super newfs_super; 
+struct newfs_super newfs_super = {
+	.lock      = PTHREAD_RWLOCK_INITIALIZER,
+	.load_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wb        = { .lock = PTHREAD_MUTEX_INITIALIZER },
+	.ra        = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
 /******************************************************************************
 * SECTION: FUSE操作定义  回调函数
 *******************************************************************************/
@@ -25,16 +41,22 @@ static struct fuse_operations operations = {
 	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
 	.readdir = newfs_readdir,				 /* 填充dentrys */
 	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
+	.write = newfs_write,					 /* 写入文件 */
+	.read = newfs_read,						 /* 读文件 */
+	.write_buf = newfs_write_buf,			 /* 写入文件，数据以fuse_bufvec给出，可直接来自管道 */
+	.read_buf = newfs_read_buf,				 /* 读文件，整块直接从设备文件splice给内核 */
 	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
-	.unlink = NULL,							  		 /* 删除文件 */
-	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
-	.rename = NULL,							  		 /* 重命名，mv */
-
-	.open = NULL,							
-	.opendir = NULL,
+	.truncate = newfs_truncate,				 /* 改变文件大小 */
+	.unlink = newfs_unlink,					 /* 删除文件 */
+	.rmdir	= newfs_rmdir,					 /* 删除目录， rm -r */
+	.rename = newfs_rename,					 /* 重命名，mv */
+	.fsync = newfs_fsync,					 /* 提交元数据日志 */
+	.fsyncdir = newfs_fsync,
+
+	.open = newfs_open,						 /* 分配预读状态 */
+	.release = newfs_release,
+	.opendir = newfs_opendir,				 /* 记录打开的目录句柄，期间不压缩目录槽位 */
+	.releasedir = newfs_releasedir,
 	.access = NULL
 };
 /******************************************************************************
@@ -48,11 +70,21 @@ static struct fuse_operations operations = {
  */
 void* newfs_init(struct fuse_conn_info * conn_info) {
 	/* TODO: 在这里进行挂载 */
+	if (!newfs_options.no_buf_io) {						/* 允许内核以splice传递读写数据 */
+		conn_info->want |= conn_info->capable & 
+						   (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+	}
 	if(newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] mount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	}
+	if(newfs_wb_start(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] writeback thread error\n", __func__);
+	}
+	if(newfs_ra_start(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] readahead thread error\n", __func__);
+	}
 	return NULL;
 
 	/* 下面是一个控制设备的示例 */
@@ -68,7 +100,13 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
  */
 void newfs_destroy(void* p) {
 	/* TODO: 在这里进行卸载 */
-	if(newfs_umount() != NEWFS_ERROR_NONE){
+	int ret;
+	newfs_ra_stop();
+	newfs_wb_stop();
+	NEWFS_WRLOCK();
+	ret = newfs_umount();
+	NEWFS_UNLOCK();
+	if(ret != NEWFS_ERROR_NONE){
 		NEWFS_DBG("[%s] mount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
 		return;
@@ -89,53 +127,51 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	/* TODO: 解析路径，创建目录 */
 	(void)mode;
 	boolean is_find, is_root;
-	char* fname;
 
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* dentry;
-	struct newfs_inode*  inode;
+	struct newfs_dentry* last_dentry;
 
+	newfs_wb_throttle();									/* 脏块过多时先刷写，不持有命名空间锁 */
+	NEWFS_WRLOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find) {
+		NEWFS_UNLOCK();
 		return -NEWFS_ERROR_EXISTS;
 	}
 
 	if (NEWFS_IS_FILE(last_dentry->inode)) {
+		NEWFS_UNLOCK();
 		return -NEWFS_ERROR_UNSUPPORTED;
 	}
 
-	fname  = newfs_get_fname(path);
-	dentry = new_dentry(fname, NEWFS_DIR); 
-	dentry->parent = last_dentry;
-	inode  = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (newfs_create_dentry(last_dentry, newfs_get_fname(path), NEWFS_DIR) == NULL) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_dcache_invalidate_neg();
+	NEWFS_UNLOCK();
 	
 	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 获取文件或目录的属性，该函数非常重要
+ * @brief 按dentry填充文件属性，getattr与低层接口共用
  * 
- * @param path 相对于挂载点的路径
- * @param NEWfs_stat 返回状态
- * @return int 0成功，否则失败
+ * @param dentry inode须已读入
+ * @param newfs_stat 返回状态
  */
-int newfs_getattr(const char* path, struct stat * newfs_stat) {
-	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
-	boolean	is_find, is_root;
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-
-	if (is_find == FALSE) {
-		return -NEWFS_ERROR_NOTFOUND;
-	}
-
+void newfs_fill_stat(struct newfs_dentry* dentry, struct stat* newfs_stat) {
+	memset(newfs_stat, 0, sizeof(struct stat));
+	newfs_stat->st_ino = dentry->ino + 1;					/* 低层接口中根目录须为 FUSE_ROOT_ID */
 	if (NEWFS_IS_DIR(dentry->inode)) {
 		newfs_stat->st_mode = S_IFDIR | NEWFS_DEFAULT_PERM;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
+		newfs_stat->st_size = NEWFS_BLKS_SZ(dentry->inode->blks);
 	}
 
 	else if (NEWFS_IS_FILE(dentry->inode)) {
 		newfs_stat->st_mode = S_IFREG | NEWFS_DEFAULT_PERM;
+		NEWFS_INODE_RDLOCK(dentry->inode);					/* 与并发的写、改变大小互斥 */
 		newfs_stat->st_size = dentry->inode->size;
+		NEWFS_INODE_UNLOCK(dentry->inode);
 	}
 
 	newfs_stat->st_nlink = 1;
@@ -145,11 +181,34 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	newfs_stat->st_mtime   = time(NULL);
 	newfs_stat->st_blksize = NEWFS_BLK_SZ(); 					
 	
-	if (is_root) {
+	if (dentry == newfs_super.root_dentry) {
 		newfs_stat->st_size	= newfs_super.sz_usage; 
 		newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
 		newfs_stat->st_nlink  = 2;								/* !特殊，根目录link数为2 */
 	}
+}
+
+/**
+ * @brief 获取文件或目录的属性，该函数非常重要
+ * 
+ * @param path 相对于挂载点的路径
+ * @param NEWfs_stat 返回状态
+ * @return int 0成功，否则失败
+ */
+int newfs_getattr(const char* path, struct stat * newfs_stat) {
+	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+
+	newfs_fill_stat(dentry, newfs_stat);
+	NEWFS_UNLOCK();
 	return NEWFS_ERROR_NONE;
 }
 
@@ -165,9 +224,10 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * buf: name会被复制到buf中
  * name: dentry名字
  * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * off: 下一次offset从哪里开始，这里取目录项槽位+1，非0时filler在buf满后返回1。
+ * 槽位在目录项存在期间不变，读到一半时删除或新建其他目录项不会使已有的目录项被漏读或重复
  * 
- * @param offset 第几个目录项？
+ * @param offset 从槽位offset开始填充
  * @param fi 可忽略
  * @return int 0成功，否则失败
  */
@@ -175,21 +235,37 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
 			    		 struct fuse_file_info * fi) {
     /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
     boolean	is_find, is_root;
-	int		cur_dir = offset;
+	int		cnt, cur_dir;
+	struct stat	st;
 
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* sub_dentry;
-	struct newfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		// inode = dentry->parent->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->name, NULL, ++offset);
+	struct newfs_dentry* dentry;
+	struct newfs_dentry** slots;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (!NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	cnt = newfs_dir_slots(dentry->inode, &slots);
+
+	memset(&st, 0, sizeof(struct stat));					/* 只带类型，ls不必为判断类型逐项getattr */
+	for (cur_dir = offset; cur_dir < cnt; cur_dir++) {
+		if (slots[cur_dir] == NULL) {						/* 删除留下的空槽 */
+			continue;
+		}
+		st.st_ino  = slots[cur_dir]->ino + 1;
+		st.st_mode = slots[cur_dir]->ftype == NEWFS_DIR ? S_IFDIR : S_IFREG;
+		if (filler(buf, slots[cur_dir]->name, &st, cur_dir + 1)) {
+			break;											/* buf已满，内核下次从cur_dir续读 */
 		}
-		return NEWFS_ERROR_NONE;
 	}
-	return -NEWFS_ERROR_NOTFOUND;
+	NEWFS_UNLOCK();
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -204,27 +280,23 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	/* TODO: 解析路径，并创建相应的文件 */
 	boolean	is_find, is_root;
 	
-	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* dentry;
-	struct newfs_inode* inode;
-	char* fname;
+	struct newfs_dentry* last_dentry;
 
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	last_dentry = newfs_lookup(path, &is_find, &is_root);
 	if (is_find == TRUE) {
+		NEWFS_UNLOCK();
 		return -NEWFS_ERROR_EXISTS;
 	}
 
-	fname = newfs_get_fname(path);
-
-	if (S_ISREG(mode)) {
-		dentry = new_dentry(fname, NEWFS_REG_FILE);
-	}
-
-	else if (S_ISDIR(mode)) {
-		dentry = new_dentry(fname, NEWFS_DIR);
+	if (newfs_create_dentry(last_dentry, newfs_get_fname(path), 
+							S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE) == NULL) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOSPACE;
 	}
-	dentry->parent = last_dentry;
-	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	newfs_dcache_invalidate_neg();
+	NEWFS_UNLOCK();
 
 	return NEWFS_ERROR_NONE;
 
@@ -245,6 +317,50 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
 /******************************************************************************
 * SECTION: 选做函数实现
 *******************************************************************************/
+/**
+ * @brief 按路径找到普通文件并读写，read/write与read_buf/write_buf共用
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 数据
+ * @param size 字节数
+ * @param offset 相对文件的偏移
+ * @param is_write 
+ * @param ra 打开文件的预读状态，可为NULL
+ * @return int 读写的字节数，否则为错误码
+ */
+static int newfs_path_rw(const char* path, uint8_t* buf, size_t size, off_t offset, 
+						 boolean is_write, struct newfs_ra_state* ra) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	int		ret;
+
+	if (is_write) {
+		newfs_wb_throttle();
+	}
+	NEWFS_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (is_write) {									/* 同一文件的读可以并发，写独占 */
+		NEWFS_INODE_WRLOCK(dentry->inode);
+		ret = newfs_file_write(dentry->inode, buf, size, offset);
+	}
+	else {
+		NEWFS_INODE_RDLOCK(dentry->inode);
+		newfs_ra_update(dentry->inode, ra, offset, size);
+		ret = newfs_file_read(dentry->inode, buf, size, offset);
+	}
+	NEWFS_INODE_UNLOCK(dentry->inode);
+	NEWFS_UNLOCK();
+	return ret;
+}
+
 /**
  * @brief 写入文件
  * 
@@ -257,8 +373,8 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	(void)fi;
+	return newfs_path_rw(path, (uint8_t *)buf, size, offset, TRUE, NULL);
 }
 
 /**
@@ -268,13 +384,88 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi fh为预读状态，可为NULL
  * @return int 读取大小
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	return newfs_path_rw(path, (uint8_t *)buf, size, offset, FALSE, NEWFS_RA_STATE(fi));
+}
+
+/**
+ * @brief 写入文件（fuse_bufvec版本）
+ * 
+ * 数据只有一段内存时直接写入，不做拷贝；来自管道（splice）的数据在加锁前一次性拷入
+ * 按IO单位对齐的缓冲区，整块部分随后由驱动直接写盘，不再经过块缓存。
+ * 
+ * @param path 相对于挂载点的路径
+ * @param buf 写入的内容
+ * @param offset 相对文件的偏移
+ * @param fi 可忽略
+ * @return int 写入大小
+ */
+int newfs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset,
+		            struct fuse_file_info* fi) {
+	size_t	size = fuse_buf_size(buf);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	void*	mem;
+	ssize_t	copied;
+	int		ret;
+	(void)fi;
+
+	if (buf->count == 1 && !(buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+		return newfs_path_rw(path, (uint8_t *)buf->buf[0].mem + buf->off, size - buf->off, offset, TRUE, NULL);
+	}
+
+	if (posix_memalign(&mem, NEWFS_IO_SZ(), size) != 0) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	dst.buf[0].mem = mem;
+	copied = fuse_buf_copy(&dst, buf, 0);
+	if (copied < 0) {
+		free(mem);
+		return copied;
+	}
+	ret = newfs_path_rw(path, mem, copied, offset, TRUE, NULL);
+	free(mem);
+	return ret;
+}
+
+/**
+ * @brief 读取文件（fuse_bufvec版本）
+ * 
+ * 磁盘上内容最新的整块以设备文件中的位置给出，FUSE直接从设备splice给内核，不经过本进程的内存；
+ * 其余部分读入新申请的缓冲区，见 newfs_file_read_buf。FUSE回复后负责释放。
+ * 
+ * @param path 相对于挂载点的路径
+ * @param bufp 输出，读取的内容
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @param fi fh为预读状态，可为NULL
+ * @return int 0成功，否则失败
+ */
+int newfs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset,
+		           struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	int		ret;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		ret = -NEWFS_ERROR_NOTFOUND;
+	}
+	else if (NEWFS_IS_DIR(dentry->inode)) {
+		ret = -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		NEWFS_INODE_RDLOCK(dentry->inode);
+		newfs_ra_update(dentry->inode, NEWFS_RA_STATE(fi), offset, size);
+		ret = newfs_file_read_buf(dentry->inode, bufp, size, offset);
+		NEWFS_INODE_UNLOCK(dentry->inode);
+	}
+	NEWFS_UNLOCK();
+	return ret < 0 ? ret : NEWFS_ERROR_NONE;
 }
 
 /**
@@ -284,8 +475,25 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
  * @return int 0成功，否则失败
  */
 int newfs_unlink(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	int		ret;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_ISDIR;
+	}
+	ret = newfs_remove_dentry(dentry);
+	newfs_dcache_invalidate(path);
+	NEWFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -301,8 +509,29 @@ int newfs_unlink(const char* path) {
  * @return int 0成功，否则失败
  */
 int newfs_rmdir(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	int		ret;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (is_root) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (NEWFS_IS_FILE(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	ret = newfs_remove_dentry(dentry);				/* 非空目录返回 -ENOTEMPTY */
+	newfs_dcache_invalidate(path);
+	NEWFS_UNLOCK();
+	return ret;
 }
 
 /**
@@ -313,32 +542,122 @@ int newfs_rmdir(const char* path) {
  * @return int 0成功，否则失败
  */
 int newfs_rename(const char* from, const char* to) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* from_dentry;
+	struct newfs_dentry* to_parent;
+	struct newfs_dentry* to_dentry;
+	int		from_len = strlen(from);
+	int		ret;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	from_dentry = newfs_lookup(from, &is_find, &is_root);
+	if (is_find == FALSE || is_root) {
+		NEWFS_UNLOCK();
+		return is_root ? -NEWFS_ERROR_INVAL : -NEWFS_ERROR_NOTFOUND;
+	}
+
+	if (strncmp(to, from, from_len) == 0 && to[from_len] == '/') {	/* 不能移动到自己的子目录下 */
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_INVAL;
+	}
+
+	to_parent = newfs_lookup(to, &is_find, &is_root);
+	to_dentry = NULL;
+	if (is_find) {									/* 目标已存在：同类型时替换，移动成功后才删除 */
+		if (to_parent == from_dentry) {
+			NEWFS_UNLOCK();
+			return NEWFS_ERROR_NONE;
+		}
+		if (is_root || NEWFS_IS_DIR(to_parent->inode) != NEWFS_IS_DIR(from_dentry->inode)) {
+			NEWFS_UNLOCK();
+			return NEWFS_IS_DIR(from_dentry->inode) ? -NEWFS_ERROR_NOTDIR : -NEWFS_ERROR_ISDIR;
+		}
+		to_dentry = to_parent;
+		to_parent = to_dentry->parent;
+	}
+
+	if (NEWFS_IS_FILE(to_parent->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
+
+	if ((ret = newfs_move_dentry(from_dentry, to_parent, newfs_get_fname(to), to_dentry)) != NEWFS_ERROR_NONE) {
+		NEWFS_UNLOCK();
+		return ret;
+	}
+
+	newfs_dcache_invalidate(from);						/* 原路径及其子路径的缓存全部失效 */
+	newfs_dcache_invalidate(to);
+	NEWFS_UNLOCK();
+	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 打开文件，fi->fh存放该打开文件的预读状态，申请失败时不预读
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
+	(void)path;
+	fi->fh = (uint64_t)(uintptr_t)calloc(1, sizeof(struct newfs_ra_state));
+	return 0;
+}
+
+/**
+ * @brief 关闭文件，释放预读状态
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	(void)path;
+	free(NEWFS_RA_STATE(fi));
+	fi->fh = 0;
 	return 0;
 }
 
 /**
- * @brief 打开目录文件
+ * @brief 打开目录文件，计入打开的目录句柄：句柄按槽位续读，期间删除目录项不压缩槽位
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	(void)fi;
+
+	NEWFS_RDLOCK();											/* 压缩在写锁下进行，计数后不会再压缩 */
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (!NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	__atomic_add_fetch(&newfs_super.dir_opens, 1, __ATOMIC_RELEASE);
+	NEWFS_UNLOCK();
+	return 0;
+}
+
+/**
+ * @brief 关闭目录文件
+ * 
+ * @param path 可忽略
+ * @param fi 可忽略
+ * @return int 0成功
+ */
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	(void)path;
+	(void)fi;
+	__atomic_sub_fetch(&newfs_super.dir_opens, 1, __ATOMIC_RELEASE);
 	return 0;
 }
 
@@ -350,8 +669,41 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry;
+	int		ret;
+
+	newfs_wb_throttle();
+	NEWFS_RDLOCK();
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (is_find == FALSE) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		return -NEWFS_ERROR_ISDIR;
+	}
+	NEWFS_INODE_WRLOCK(dentry->inode);
+	ret = newfs_file_truncate(dentry->inode, offset);
+	NEWFS_INODE_UNLOCK(dentry->inode);
+	NEWFS_UNLOCK();
+	return ret;
+}
+/**
+ * @brief 同步文件或目录。对齐的整块数据已直接写盘，其余经过块缓存的块随元数据一起提交：
+ * 启用日志时是一次顺序的日志写，并发的fsync合并为一次提交
+ * 
+ * @param path 相对于挂载点的路径，不使用
+ * @param datasync 不区分
+ * @param fi 不使用
+ * @return int 0成功，否则失败
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	(void)path;
+	(void)datasync;
+	(void)fi;
+	return newfs_journal_sync();
 }
 
 
@@ -380,11 +732,26 @@ int main(int argc, char **argv)
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	newfs_options.device = strdup("/home/students/200111116/ddriver");
+	newfs_options.cache_blks = NEWFS_BCACHE_BLKS;
+	newfs_options.wb_interval_ms = NEWFS_WB_INTERVAL_MS;
+	newfs_options.wb_expire_ms = NEWFS_WB_EXPIRE_MS;
+	newfs_options.wb_dirty_kb = NEWFS_WB_DIRTY_KB;
+	newfs_options.ra_kb = NEWFS_RA_KB;
+	newfs_options.uring_depth = NEWFS_URING_DEPTH;
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
+	if (newfs_options.no_buf_io) {						/* 用于对比测试：退回read/write */
+		operations.write_buf = NULL;
+		operations.read_buf  = NULL;
+	}
 	
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	if (newfs_options.lowlevel) {						/* 内核以inode号访问，不再逐层解析路径 */
+		ret = newfs_ll_main(&args);
+	}
+	else {
+		ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	}
 	fuse_opt_free_args(&args);
 	return ret;
 }
\ No newline at end of file
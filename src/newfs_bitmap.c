@@ -0,0 +1,561 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_WORD_BITS                   64
+#define NEWFS_WORD_FULL                   (~(uint64_t)0)
+#define NEWFS_WORDS(bits)                 (((bits) + NEWFS_WORD_BITS - 1) / NEWFS_WORD_BITS)
+
+/**
+ * 位图按64位字扫描，磁盘上的位序为 第i位 = 第i/8字节的第i%8位，
+ * 在小端机器上与 uint64_t 的第i%64位一致，因此直接以字的方式访问内存位图。
+ * 汇总层 summary 中第w位表示 words[w] 已满，分配时先在汇总层找未满的字，
+ * 再在字内用ctz找空闲位，满盘时每次分配也只需扫描 nwords/64 个汇总字。
+ * 每个位图有自己的锁，不同文件的并发写只在分配数据块的瞬间互斥。
+ * 延迟挂载时位图不在挂载时读入，由第一次分配或释放在持锁状态下读入。
+ * 位图按块组划分，每个块组的位在内存中相连、在磁盘上各占一段（从块边界开始），
+ * 分配从调用者给出的goal（通常为父目录或文件所在块组的第一位）开始找，使相关的inode与数据块聚在同一块组。
+ * 数据块交给FUSE从设备文件直接读取时（见 newfs_file_read_buf），FUSE在文件系统的锁释放后才读，
+ * 此时释放的块若立即分给别的文件，读到的可能是别的文件的新内容。因此数据位图可以保留刚释放的位：
+ * 磁盘位图照常清除，但这些位在两次回写之后才重新参与分配，空间不足时提前放回。
+ */
+
+/**
+ * @brief 第w个字，超出nbits的尾部位视为已占用
+ *
+ * @param bm
+ * @param w
+ * @return uint64_t
+ */
+static inline uint64_t newfs_bitmap_word(struct newfs_bitmap* bm, int w) {
+    int      tail = bm->nbits - w * NEWFS_WORD_BITS;
+    uint64_t word = bm->words[w];
+    if (bm->pinned != NULL) {
+        word |= bm->pinned[w] | bm->pinned_old[w];    /* 保留的位视为已占用 */
+    }
+    if (tail >= NEWFS_WORD_BITS) {
+        return word;
+    }
+    return word | (NEWFS_WORD_FULL << tail);
+}
+/**
+ * @brief 根据words[w]是否已满更新汇总层
+ *
+ * @param bm
+ * @param w
+ */
+static inline void newfs_bitmap_update_summary(struct newfs_bitmap* bm, int w) {
+    uint64_t mask = (uint64_t)1 << (w % NEWFS_WORD_BITS);
+    if (newfs_bitmap_word(bm, w) == NEWFS_WORD_FULL) {
+        bm->summary[w / NEWFS_WORD_BITS] |= mask;
+    }
+    else {
+        bm->summary[w / NEWFS_WORD_BITS] &= ~mask;
+    }
+}
+/**
+ * @brief 标记bit所在块组的位图需要回写
+ *
+ * @param bm
+ * @param bit
+ */
+static void newfs_bitmap_dirty(struct newfs_bitmap* bm, int bit) {
+    int g = bit / bm->group_bits;
+    if (!bm->map_dirty[g]) {
+        bm->map_dirty[g] = TRUE;
+        newfs_mark_dirty(NEWFS_BLK_SZ());
+    }
+}
+/**
+ * @brief 块组g的位图在磁盘上的有效字节数，最后一个块组可能不满
+ *
+ * @param bm
+ * @param g
+ * @return int
+ */
+static int newfs_bitmap_group_bytes(struct newfs_bitmap* bm, int g) {
+    int bits = bm->nbits - g * bm->group_bits;
+    if (bits > bm->group_bits) {
+        bits = bm->group_bits;
+    }
+    return (bits + UINT8_BITS - 1) / UINT8_BITS;
+}
+/**
+ * @brief 按内存位图建立汇总层，统计每个块组已占用的位数
+ *
+ * @param bm
+ * @return int
+ */
+static int newfs_bitmap_build(struct newfs_bitmap* bm) {
+    int nsum = NEWFS_WORDS(bm->nwords);
+    int w, cnt;
+
+    bm->summary    = (uint64_t *)calloc(nsum, sizeof(uint64_t));
+    bm->group_used = (int *)calloc(bm->groups, sizeof(int));
+    if (bm->summary == NULL || bm->group_used == NULL) {
+        free(bm->summary);
+        free(bm->group_used);
+        bm->summary    = NULL;
+        bm->group_used = NULL;
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (w = bm->nwords; w < nsum * NEWFS_WORD_BITS; w++) {   /* 不存在的字视为已满 */
+        bm->summary[w / NEWFS_WORD_BITS] |= (uint64_t)1 << (w % NEWFS_WORD_BITS);
+    }
+    bm->used = 0;
+    for (w = 0; w < bm->nwords; w++) {
+        newfs_bitmap_update_summary(bm, w);
+        cnt       = __builtin_popcountll(bm->words[w]);
+        bm->used += cnt;
+        bm->group_used[w * NEWFS_WORD_BITS / bm->group_bits] += cnt;
+    }
+    bm->is_loaded = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 记录位图的块组划分和磁盘位置，位图内容由 newfs_bitmap_load 或 newfs_bitmap_format 建立，
+ * 延迟挂载时由第一次分配或释放读入
+ *
+ * @param bm
+ * @param map 内存位图，各块组的位依次相连，大小至少为 nbits/8 字节，按8字节对齐
+ * @param nbits 有效位数
+ * @param group_bits 每个块组的位数，多于一个块组时为64的倍数
+ * @param map_dirty 每个块组的位图是否需要回写
+ * @param map_offset 块组0的位图在磁盘上的偏移
+ * @param map_stride 相邻块组位图的距离（字节）
+ * @return int
+ */
+int newfs_bitmap_init(struct newfs_bitmap* bm, uint8_t* map, int nbits, int group_bits,
+                      uint8_t* map_dirty, int map_offset, int map_stride) {
+    memset(bm, 0, sizeof(struct newfs_bitmap));
+    if (group_bits <= 0) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    bm->words      = (uint64_t *)map;
+    bm->nbits      = nbits;
+    bm->nwords     = NEWFS_WORDS(nbits);
+    bm->group_bits = group_bits;
+    bm->groups     = (nbits + group_bits - 1) / group_bits;
+    bm->map_dirty  = map_dirty;
+    bm->map_offset = map_offset;
+    bm->map_stride = map_stride;
+    pthread_mutex_init(&bm->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 位图尚未读入时逐个块组读入，调用者持有bm->lock
+ *
+ * @param bm
+ * @return int
+ */
+static int newfs_bitmap_ensure(struct newfs_bitmap* bm) {
+    int g;
+
+    if (bm->is_loaded) {
+        return NEWFS_ERROR_NONE;
+    }
+    for (g = 0; g < bm->groups; g++) {
+        if (newfs_driver_read(bm->map_offset + g * bm->map_stride,
+                              (uint8_t *)bm->words + g * (bm->group_bits / UINT8_BITS),
+                              newfs_bitmap_group_bytes(bm, g)) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] read bitmap of group %d failed\n", __func__, g);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return newfs_bitmap_build(bm);
+}
+/**
+ * @brief 从磁盘读入位图
+ *
+ * @param bm
+ * @return int
+ */
+int newfs_bitmap_load(struct newfs_bitmap* bm) {
+    int ret;
+    pthread_mutex_lock(&bm->lock);
+    ret = newfs_bitmap_ensure(bm);
+    pthread_mutex_unlock(&bm->lock);
+    return ret;
+}
+/**
+ * @brief 格式化时清空位图，全部块组等待回写
+ *
+ * @param bm
+ * @return int
+ */
+int newfs_bitmap_format(struct newfs_bitmap* bm) {
+    memset(bm->words, 0, bm->nwords * sizeof(uint64_t));
+    memset(bm->map_dirty, TRUE, bm->groups);
+    return newfs_bitmap_build(bm);
+}
+/**
+ * @brief 将修改过的块组位图写回，每个块组的位图从块边界开始，不足一块的部分补0
+ *
+ * @param bm
+ * @return int
+ */
+int newfs_bitmap_sync(struct newfs_bitmap* bm) {
+    uint8_t* blk;
+    int      g, ofs, len, bytes;
+    int      ret = NEWFS_ERROR_NONE;
+
+    pthread_mutex_lock(&bm->lock);
+    if (!bm->is_loaded) {                             /* 未读入的位图不会有修改 */
+        pthread_mutex_unlock(&bm->lock);
+        return NEWFS_ERROR_NONE;
+    }
+    blk = (uint8_t *)malloc(NEWFS_BLK_SZ());
+    if (blk == NULL) {
+        pthread_mutex_unlock(&bm->lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (g = 0; g < bm->groups && ret == NEWFS_ERROR_NONE; g++) {
+        if (!bm->map_dirty[g]) {
+            continue;
+        }
+        bytes = newfs_bitmap_group_bytes(bm, g);
+        for (ofs = 0; ofs < bytes; ofs += NEWFS_BLK_SZ()) {
+            len = bytes - ofs < NEWFS_BLK_SZ() ? bytes - ofs : NEWFS_BLK_SZ();
+            memset(blk, 0, NEWFS_BLK_SZ());
+            memcpy(blk, (uint8_t *)bm->words + g * (bm->group_bits / UINT8_BITS) + ofs, len);
+            if (newfs_driver_write(bm->map_offset + g * bm->map_stride + ofs, blk,
+                                   NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+                break;
+            }
+        }
+        if (ret == NEWFS_ERROR_NONE) {
+            bm->map_dirty[g] = FALSE;
+        }
+    }
+    free(blk);
+    pthread_mutex_unlock(&bm->lock);
+    return ret;
+}
+/**
+ * @brief 块号blkno是否存放这张位图的一部分，只用到挂载后不变的字段，无需加锁
+ *
+ * @param bm
+ * @param blkno
+ * @return boolean
+ */
+boolean newfs_bitmap_owns(struct newfs_bitmap* bm, int blkno) {
+    int ofs = blkno * NEWFS_BLK_SZ() - bm->map_offset;
+    int g;
+
+    if (ofs < 0 || bm->map_stride <= 0) {
+        return FALSE;
+    }
+    g = ofs / bm->map_stride;
+    return g < bm->groups && ofs % bm->map_stride < newfs_bitmap_group_bytes(bm, g);
+}
+/**
+ * @brief 释放汇总层，内存位图本身由 newfs_umount 释放
+ *
+ * @param bm
+ */
+void newfs_bitmap_destroy(struct newfs_bitmap* bm) {
+    if (bm->words == NULL) {
+        return;
+    }
+    free(bm->summary);
+    free(bm->group_used);
+    free(bm->pinned);
+    free(bm->pinned_old);
+    bm->summary    = NULL;
+    bm->group_used = NULL;
+    bm->pinned     = NULL;
+    bm->pinned_old = NULL;
+    bm->words      = NULL;
+    bm->is_loaded  = FALSE;
+    pthread_mutex_destroy(&bm->lock);
+}
+/**
+ * @brief 此后释放的位保留到两次 newfs_bitmap_unpin 之后才重新分配，在挂载后、第一次释放之前调用
+ *
+ * @param bm
+ * @return int
+ */
+int newfs_bitmap_pin(struct newfs_bitmap* bm) {
+    uint64_t* pinned     = (uint64_t *)calloc(bm->nwords, sizeof(uint64_t));
+    uint64_t* pinned_old = (uint64_t *)calloc(bm->nwords, sizeof(uint64_t));
+
+    if (pinned == NULL || pinned_old == NULL) {
+        free(pinned);
+        free(pinned_old);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_lock(&bm->lock);
+    bm->pinned     = pinned;
+    bm->pinned_old = pinned_old;
+    bm->pinned_cnt = 0;
+    pthread_mutex_unlock(&bm->lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 放回上一周期保留的位，本周期保留的位转为上一周期；is_all时全部放回。调用者持有bm->lock
+ *
+ * @param bm
+ * @param is_all
+ */
+static void newfs_bitmap_unpin_locked(struct newfs_bitmap* bm, boolean is_all) {
+    uint64_t old;
+    int      w;
+
+    if (bm->pinned_cnt == 0) {
+        return;
+    }
+    bm->pinned_cnt = 0;
+    for (w = 0; w < bm->nwords; w++) {
+        old                = bm->pinned_old[w] | (is_all ? bm->pinned[w] : 0);
+        bm->pinned_old[w]  = is_all ? 0 : bm->pinned[w];
+        bm->pinned[w]      = 0;
+        bm->pinned_cnt    += __builtin_popcountll(bm->pinned_old[w]);
+        if (old != 0) {
+            newfs_bitmap_update_summary(bm, w);
+        }
+    }
+}
+/**
+ * @brief 一次回写完成：放回上一周期保留的位。此前交给FUSE的读请求早已回复
+ *
+ * @param bm
+ */
+void newfs_bitmap_unpin(struct newfs_bitmap* bm) {
+    pthread_mutex_lock(&bm->lock);
+    if (bm->pinned != NULL && bm->is_loaded) {
+        newfs_bitmap_unpin_locked(bm, FALSE);
+    }
+    pthread_mutex_unlock(&bm->lock);
+}
+/**
+ * @brief 从第from个字开始在汇总层中找第一个未满的字，找不到时回绕
+ *
+ * @param bm
+ * @param from 起始字：指定了goal时为goal所在的字，否则为上次分配所在的字（next-fit）
+ * @return int 字下标，位图已满返回-1
+ */
+static int newfs_bitmap_find_word(struct newfs_bitmap* bm, int from) {
+    int      nsum  = NEWFS_WORDS(bm->nwords);
+    int      start = from / NEWFS_WORD_BITS;
+    uint64_t low   = ((uint64_t)1 << (from % NEWFS_WORD_BITS)) - 1;
+    uint64_t avail;
+    int      k, s;
+
+    for (k = 0; k <= nsum; k++) {
+        s     = (start + k) % nsum;
+        avail = ~bm->summary[s];
+        if (k == 0) {
+            avail &= ~low;                            /* 先找from及之后的字 */
+        }
+        else if (k == nsum) {
+            avail &= low;                             /* 回绕到from之前的字 */
+        }
+        if (avail != 0) {
+            return s * NEWFS_WORD_BITS + __builtin_ctzll(avail);
+        }
+    }
+    return -1;
+}
+/**
+ * @brief 从第from个字开始找未满的字，位图已满但有保留的位时全部放回再找一次
+ *
+ * @param bm
+ * @param from
+ * @return int 字下标，位图已满返回-1
+ */
+static int newfs_bitmap_find_avail(struct newfs_bitmap* bm, int from) {
+    int w = newfs_bitmap_find_word(bm, from);
+    if (w < 0 && bm->pinned_cnt > 0) {
+        NEWFS_DBG("[%s] bitmap full, release %d pinned bits\n", __func__, bm->pinned_cnt);
+        newfs_bitmap_unpin_locked(bm, TRUE);
+        w = newfs_bitmap_find_word(bm, from);
+    }
+    return w;
+}
+/**
+ * @brief 搜索的起始字：goal有效时为goal所在的字，否则为上次分配所在的字
+ *
+ * @param bm
+ * @param goal
+ * @return int
+ */
+static inline int newfs_bitmap_from(struct newfs_bitmap* bm, int goal) {
+    return goal >= 0 && goal < bm->nbits ? goal / NEWFS_WORD_BITS : bm->hint;
+}
+/**
+ * @brief 分配一个空闲位，从goal开始向后找，找不到时回绕
+ *
+ * @param bm
+ * @param goal 期望的位（通常为某个块组的第一位），-1表示接着上次分配的位置
+ * @return int 分配到的位，位图已满返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_bitmap_alloc(struct newfs_bitmap* bm, int goal) {
+    int w;
+    int bit;
+
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_ensure(bm) != NEWFS_ERROR_NONE) {
+        pthread_mutex_unlock(&bm->lock);
+        return -NEWFS_ERROR_IO;
+    }
+    w = newfs_bitmap_find_avail(bm, newfs_bitmap_from(bm, goal));
+    if (w < 0) {
+        pthread_mutex_unlock(&bm->lock);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    bit = w * NEWFS_WORD_BITS + __builtin_ctzll(~newfs_bitmap_word(bm, w));
+    bm->words[w] |= (uint64_t)1 << (bit % NEWFS_WORD_BITS);
+    newfs_bitmap_update_summary(bm, w);
+    newfs_bitmap_dirty(bm, bit);
+    bm->hint = w;
+    bm->used++;
+    bm->group_used[bit / bm->group_bits]++;
+    pthread_mutex_unlock(&bm->lock);
+    return bit;
+}
+/**
+ * @brief 清除一个位，调用者持有bm->lock
+ *
+ * @param bm
+ * @param bit
+ */
+static void newfs_bitmap_clear(struct newfs_bitmap* bm, int bit) {
+    int      w    = bit / NEWFS_WORD_BITS;
+    uint64_t mask = (uint64_t)1 << (bit % NEWFS_WORD_BITS);
+
+    if (bit < 0 || bit >= bm->nbits || !(bm->words[w] & mask)) {
+        NEWFS_DBG("[%s] bit %d is not allocated\n", __func__, bit);
+        return;
+    }
+    bm->words[w] &= ~mask;
+    if (bm->pinned != NULL) {
+        bm->pinned[w] |= mask;
+        bm->pinned_cnt++;
+    }
+    newfs_bitmap_update_summary(bm, w);
+    newfs_bitmap_dirty(bm, bit);
+    bm->used--;
+    bm->group_used[bit / bm->group_bits]--;
+}
+/**
+ * @brief 释放一个位
+ *
+ * @param bm
+ * @param bit
+ */
+void newfs_bitmap_free(struct newfs_bitmap* bm, int bit) {
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_ensure(bm) == NEWFS_ERROR_NONE) {
+        newfs_bitmap_clear(bm, bit);
+    }
+    pthread_mutex_unlock(&bm->lock);
+}
+/**
+ * @brief 分配一段连续的空闲位：goal空闲时从goal开始（便于接在文件最后一个extent之后），
+ * 否则从goal之后的第一个空闲位开始，向后按字延伸，最多want位，不跨越块组
+ *
+ * @param bm
+ * @param goal 期望的起始位，-1表示不指定
+ * @param want 期望的位数
+ * @param len 输出，实际分配的位数（1..want）
+ * @return int 起始位，位图已满返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_bitmap_alloc_run(struct newfs_bitmap* bm, int goal, int want, int* len) {
+    uint64_t avail;
+    uint64_t mask;
+    int      start, bit;
+    int      w, b, run;
+
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_ensure(bm) != NEWFS_ERROR_NONE) {
+        pthread_mutex_unlock(&bm->lock);
+        return -NEWFS_ERROR_IO;
+    }
+    if (goal >= 0 && goal < bm->nbits &&
+        !(newfs_bitmap_word(bm, goal / NEWFS_WORD_BITS) & ((uint64_t)1 << (goal % NEWFS_WORD_BITS)))) {
+        start = goal;
+    }
+    else {
+        w = newfs_bitmap_find_avail(bm, newfs_bitmap_from(bm, goal));
+        if (w < 0) {
+            pthread_mutex_unlock(&bm->lock);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        start = w * NEWFS_WORD_BITS + __builtin_ctzll(~newfs_bitmap_word(bm, w));
+    }
+    if (want > (start / bm->group_bits + 1) * bm->group_bits - start) {
+        want = (start / bm->group_bits + 1) * bm->group_bits - start;   /* 块组之间在磁盘上不相邻 */
+    }
+
+    *len = 0;
+    while (*len < want) {
+        bit   = start + *len;
+        w     = bit / NEWFS_WORD_BITS;
+        b     = bit % NEWFS_WORD_BITS;
+        if (w >= bm->nwords) {
+            break;
+        }
+        avail = ~newfs_bitmap_word(bm, w) >> b;       /* 1表示空闲，高位移入的0视为占用 */
+        run   = ~avail == 0 ? NEWFS_WORD_BITS : __builtin_ctzll(~avail);
+        if (run == 0) {
+            break;
+        }
+        if (run > want - *len) {
+            run = want - *len;
+        }
+        mask  = run == NEWFS_WORD_BITS ? NEWFS_WORD_FULL : (((uint64_t)1 << run) - 1) << b;
+        bm->words[w] |= mask;
+        newfs_bitmap_update_summary(bm, w);
+        newfs_bitmap_dirty(bm, bit);
+        bm->hint = w;
+        *len    += run;
+        if (b + run < NEWFS_WORD_BITS) {              /* 在字内遇到占用位或已满足 */
+            break;
+        }
+    }
+    bm->used += *len;
+    bm->group_used[start / bm->group_bits] += *len;
+    pthread_mutex_unlock(&bm->lock);
+    return start;
+}
+/**
+ * @brief 释放一段连续的位
+ *
+ * @param bm
+ * @param start 起始位
+ * @param len 位数
+ */
+void newfs_bitmap_free_run(struct newfs_bitmap* bm, int start, int len) {
+    int bit;
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_ensure(bm) == NEWFS_ERROR_NONE) {
+        for (bit = start; bit < start + len; bit++) {
+            newfs_bitmap_clear(bm, bit);
+        }
+    }
+    pthread_mutex_unlock(&bm->lock);
+}
+/**
+ * @brief 从块组from开始找已占用位最少的块组，用于分散新建的目录
+ *
+ * @param bm
+ * @param from 起始块组，占用相同时优先
+ * @return int 块组号，位图读入失败时返回from
+ */
+int newfs_bitmap_least_used(struct newfs_bitmap* bm, int from) {
+    int best = from;
+    int k, g;
+
+    pthread_mutex_lock(&bm->lock);
+    if (newfs_bitmap_ensure(bm) == NEWFS_ERROR_NONE) {
+        for (k = 1; k < bm->groups; k++) {
+            g = (from + k) % bm->groups;
+            if (bm->group_used[g] < bm->group_used[best]) {
+                best = g;
+            }
+        }
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return best;
+}
@@ -0,0 +1,596 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_BCACHE()                    (&newfs_super.bcache)
+#define NEWFS_BLK_OFS(blkno)              ((blkno) * NEWFS_BLK_SZ())
+
+/**
+ * @brief 设备读，从blkno开始连续读cnt个块，由后端合并为一次访问，第i块读入blks[i]
+ *
+ * @param blkno 起始块号
+ * @param blks 每个块的输出地址
+ * @param cnt 块数
+ * @return int
+ */
+int newfs_dev_read(int blkno, uint8_t **blks, int cnt) {
+    return newfs_super.dev->pread(NEWFS_DRIVER(), blks, cnt, NEWFS_BLK_SZ(), NEWFS_BLK_OFS((off_t)blkno));
+}
+/**
+ * @brief 设备写，从blkno开始连续写cnt个块，由后端合并为一次访问，第i块来自blks[i]
+ *
+ * @param blkno 起始块号
+ * @param blks 每个块的输入地址
+ * @param cnt 块数
+ * @return int
+ */
+int newfs_dev_write(int blkno, uint8_t **blks, int cnt) {
+    return newfs_super.dev->pwrite(NEWFS_DRIVER(), blks, cnt, NEWFS_BLK_SZ(), NEWFS_BLK_OFS((off_t)blkno));
+}
+/**
+ * @brief 使此前写入设备的数据落盘，用于日志提交、检查点和刷写之后
+ *
+ * @return int
+ */
+int newfs_dev_flush() {
+    return newfs_super.dev->flush(NEWFS_DRIVER());
+}
+/**
+ * @brief 可交给FUSE直接读出块内容的设备文件描述符
+ *
+ * @return int 后端不支持返回-1
+ */
+int newfs_dev_splice_fd() {
+    if (newfs_super.dev->splice_fd == NULL) {
+        return -1;
+    }
+    return newfs_super.dev->splice_fd(NEWFS_DRIVER());
+}
+/**
+ * @brief 批量提交互不重叠的多段连续访问，全部完成后返回。io_uring后端同时保持多个请求在途，
+ * 其余后端逐段执行
+ *
+ * @param reqs
+ * @param n
+ * @return int
+ */
+int newfs_dev_submit(struct newfs_dev_req* reqs, int n) {
+    return newfs_super.dev->submit(NEWFS_DRIVER(), reqs, n, NEWFS_BLK_SZ());
+}
+
+static inline int newfs_bcache_hash(int blkno) {
+    return (unsigned int)blkno % NEWFS_BCACHE()->hash_sz;
+}
+/**
+ * @brief 将缓冲块从LRU链中摘下
+ *
+ * @param buf
+ */
+static void newfs_bcache_lru_del(struct newfs_buf* buf) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    }
+    else {
+        bcache->lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    }
+    else {
+        bcache->lru_tail = buf->lru_prev;
+    }
+    buf->lru_prev = NULL;
+    buf->lru_next = NULL;
+}
+/**
+ * @brief 将缓冲块插入LRU链头（最近使用）
+ *
+ * @param buf
+ */
+static void newfs_bcache_lru_add(struct newfs_buf* buf) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    buf->lru_prev = NULL;
+    buf->lru_next = bcache->lru_head;
+    if (bcache->lru_head) {
+        bcache->lru_head->lru_prev = buf;
+    }
+    bcache->lru_head = buf;
+    if (bcache->lru_tail == NULL) {
+        bcache->lru_tail = buf;
+    }
+}
+/**
+ * @brief 将缓冲块从哈希表中移除
+ *
+ * @param buf
+ */
+static void newfs_bcache_unhash(struct newfs_buf* buf) {
+    struct newfs_buf** pprev = &NEWFS_BCACHE()->hash[newfs_bcache_hash(buf->blkno)];
+    while (*pprev) {
+        if (*pprev == buf) {
+            *pprev = buf->hash_next;
+            break;
+        }
+        pprev = &(*pprev)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+/**
+ * @brief 回写一个脏缓冲块，已提交到日志但尚未写回原位置的块同样需要回写
+ *
+ * @param buf
+ * @return int
+ */
+static int newfs_bcache_writeback(struct newfs_buf* buf) {
+    if (!(buf->flag & (NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED))) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_dev_write(buf->blkno, &buf->data, 1) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error, blkno %d\n", __func__, buf->blkno);
+        return -NEWFS_ERROR_IO;
+    }
+    buf->flag &= ~(NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED);
+    NEWFS_BCACHE()->writebacks++;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 选择被淘汰的缓冲块，从LRU尾部起跳过预读正在读入的块。启用日志时只淘汰不脏的块，
+ * 未提交的修改不能提前写回原位置
+ *
+ * @return struct newfs_buf* 没有可淘汰的块时返回NULL
+ */
+static struct newfs_buf* newfs_bcache_victim() {
+    struct newfs_buf* buf = NEWFS_BCACHE()->lru_tail;
+
+    for (; buf != NULL; buf = buf->lru_prev) {
+        if (buf->flag & NEWFS_FLAG_BUF_LOADING) {
+            continue;
+        }
+        if (!newfs_super.journal.is_enabled || !(buf->flag & NEWFS_FLAG_BUF_DIRTY)) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 临时增加一个缓冲块放在LRU链头，提交完成后由 newfs_bcache_shrink 释放
+ *
+ * @return struct newfs_buf* 内存不足返回NULL
+ */
+static struct newfs_buf* newfs_bcache_grow() {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf**   sorted;
+    struct newfs_buf*    buf;
+
+    sorted = (struct newfs_buf**)realloc(bcache->sorted, (bcache->nbufs + bcache->nextra + 1) * sizeof(struct newfs_buf*));
+    if (sorted == NULL) {
+        return NULL;
+    }
+    bcache->sorted = sorted;
+    buf = (struct newfs_buf*)calloc(1, sizeof(struct newfs_buf));
+    if (buf == NULL || posix_memalign((void **)&buf->data, NEWFS_IO_SZ(), NEWFS_BLK_SZ()) != 0) {
+        free(buf);
+        return NULL;
+    }
+    buf->blkno      = -1;
+    buf->extra_next = bcache->extra;
+    bcache->extra   = buf;
+    bcache->nextra++;
+    newfs_bcache_lru_add(buf);
+    return buf;
+}
+/**
+ * @brief 淘汰一个缓冲块（脏则先回写），将其移到LRU链头，调用者随后用 newfs_bcache_insert 放入新块。
+ * 启用日志且全部为脏时先把它们提交到日志并落盘，提交后的块只是已记录，回写的是已落盘事务中的内容；
+ * 提交期间（journal.is_open）脏元数据只写入了一部分，不能单独提交，改为临时增加缓冲块。
+ * 其余的块都在预读中时等待读入完成，期间会放开 NEWFS_BCACHE_LOCK
+ *
+ * @return struct newfs_buf* 回写、提交失败或内存不足返回NULL
+ */
+static struct newfs_buf* newfs_bcache_evict() {
+    struct newfs_buf* buf;
+
+    while ((buf = newfs_bcache_victim()) == NULL) {   /* 淘汰最久未使用的块 */
+        if (newfs_bcache_collect(NEWFS_FLAG_BUF_DIRTY) == 0) {  /* 其余的块都在预读中 */
+            pthread_cond_wait(&NEWFS_BCACHE()->io_done, &NEWFS_BCACHE()->lock);
+            continue;
+        }
+        if (newfs_super.journal.is_open) {
+            return newfs_bcache_grow();
+        }
+        NEWFS_DBG("[%s] all buffers dirty, forcing a journal commit\n", __func__);
+        if (newfs_journal_commit_locked() != NEWFS_ERROR_NONE || newfs_dev_flush() != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+    }
+    if (buf->flag & NEWFS_FLAG_BUF_OCCUPY) {
+        if (newfs_bcache_writeback(buf) != NEWFS_ERROR_NONE) {
+            return NULL;
+        }
+        newfs_bcache_unhash(buf);
+        buf->flag = 0;
+    }
+    newfs_bcache_lru_del(buf);
+    newfs_bcache_lru_add(buf);
+    return buf;
+}
+/**
+ * @brief 将缓冲块登记为块号blkno并放入哈希表
+ *
+ * @param buf
+ * @param blkno
+ */
+static void newfs_bcache_insert(struct newfs_buf* buf, int blkno) {
+    buf->blkno     = blkno;
+    buf->flag      = NEWFS_FLAG_BUF_OCCUPY;
+    buf->hash_next = NEWFS_BCACHE()->hash[newfs_bcache_hash(blkno)];
+    NEWFS_BCACHE()->hash[newfs_bcache_hash(blkno)] = buf;
+}
+/**
+ * @brief 初始化块缓存，所有缓冲块从一块按IO单位对齐的内存池中切分，
+ * 运行期间只在提交时脏块占满缓存的情况下临时申请
+ *
+ * @param nbufs 缓冲块数量
+ * @return int
+ */
+int newfs_bcache_init(int nbufs) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    int i;
+
+    if (nbufs <= 0) {
+        nbufs = NEWFS_BCACHE_BLKS;
+    }
+    memset(bcache, 0, sizeof(struct newfs_bcache));
+    bcache->nbufs   = nbufs;
+    bcache->hash_sz = nbufs * 2 + 1;
+    bcache->bufs    = (struct newfs_buf*)calloc(nbufs, sizeof(struct newfs_buf));
+    bcache->hash    = (struct newfs_buf**)calloc(bcache->hash_sz, sizeof(struct newfs_buf*));
+    bcache->sorted  = (struct newfs_buf**)calloc(nbufs, sizeof(struct newfs_buf*));
+    if (bcache->bufs == NULL || bcache->hash == NULL || bcache->sorted == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (posix_memalign((void **)&bcache->arena, NEWFS_IO_SZ(), 
+                       (size_t)nbufs * NEWFS_BLK_SZ()) != 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_super.dev->register_mem != NULL &&               /* 登记失败只是不用固定缓冲 */
+        newfs_super.dev->register_mem(NEWFS_DRIVER(), bcache->arena, (size_t)nbufs * NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] cache buffers not registered\n", __func__);
+    }
+    pthread_mutex_init(&bcache->lock, NULL);
+    pthread_cond_init(&bcache->io_done, NULL);
+    for (i = 0; i < nbufs; i++) {
+        bcache->bufs[i].blkno = -1;
+        bcache->bufs[i].data  = bcache->arena + (size_t)i * NEWFS_BLK_SZ();
+        newfs_bcache_lru_add(&bcache->bufs[i]);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 在哈希表中查找块号为blkno的缓冲块，包括正在读入的块，不等待、不放开锁
+ *
+ * @param blkno 块号
+ * @return struct newfs_buf* 未登记返回NULL
+ */
+static struct newfs_buf* newfs_bcache_find(int blkno) {
+    struct newfs_buf* buf = NEWFS_BCACHE()->hash[newfs_bcache_hash(blkno)];
+    while (buf != NULL && buf->blkno != blkno) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+/**
+ * @brief 查找块号为blkno的缓冲块，不触发淘汰和设备读，调用者持有 NEWFS_BCACHE_LOCK。
+ * 块正由预读读入时等待读入完成，期间会放开锁
+ *
+ * @param blkno 块号
+ * @return struct newfs_buf* 未缓存返回NULL
+ */
+struct newfs_buf* newfs_bcache_lookup(int blkno) {
+    struct newfs_buf* buf;
+
+    while ((buf = newfs_bcache_find(blkno)) != NULL && (buf->flag & NEWFS_FLAG_BUF_LOADING)) {
+        pthread_cond_wait(&NEWFS_BCACHE()->io_done, &NEWFS_BCACHE()->lock);    /* 读入失败时已解除登记 */
+    }
+    return buf;
+}
+/**
+ * @brief 获取块号为blkno的缓冲块，未命中时淘汰LRU尾部的缓冲块（脏则先回写）
+ * 调用者持有 NEWFS_BCACHE_LOCK 直到不再访问返回的缓冲块，否则它可能被其他线程淘汰
+ *
+ * @param blkno 块号
+ * @param is_fill 未命中时是否需要从设备读入原内容（整块覆盖写时无需读）
+ * @return struct newfs_buf* 失败返回NULL
+ */
+struct newfs_buf* newfs_bcache_get(int blkno, boolean is_fill) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf*    buf    = newfs_bcache_lookup(blkno);
+    struct newfs_buf*    hit;
+
+    if (buf) {                                        /* 命中 */
+        bcache->hits++;
+        newfs_bcache_lru_del(buf);
+        newfs_bcache_lru_add(buf);
+        return buf;
+    }
+
+    bcache->misses++;
+    buf = newfs_bcache_evict();
+    if (buf == NULL) {
+        return NULL;
+    }
+    if ((hit = newfs_bcache_lookup(blkno)) != NULL) { /* 淘汰时等待过预读，期间该块已被读入 */
+        return hit;
+    }
+
+    if (is_fill && newfs_dev_read(blkno, &buf->data, 1) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error, blkno %d\n", __func__, blkno);
+        buf->blkno = -1;
+        return NULL;
+    }
+
+    newfs_bcache_insert(buf, blkno);
+    return buf;
+}
+/**
+ * @brief 从LRU尾部起取至多n个互不相同的干净缓冲块，解除原有登记并移到LRU链头，
+ * 预读不为腾出空间回写脏块
+ *
+ * @param bufs 取得的缓冲块
+ * @param n
+ * @return int 取得的个数
+ */
+static int newfs_bcache_take_clean(struct newfs_buf** bufs, int n) {
+    struct newfs_buf* buf = NEWFS_BCACHE()->lru_tail;
+    int cnt = 0;
+    int i;
+
+    for (; buf != NULL && cnt < n; buf = buf->lru_prev) {
+        if (!(buf->flag & (NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED | NEWFS_FLAG_BUF_LOADING))) {
+            bufs[cnt++] = buf;
+        }
+    }
+    for (i = 0; i < cnt; i++) {                       /* 全部选好后再移动，避免同一块被选中两次 */
+        if (bufs[i]->flag & NEWFS_FLAG_BUF_OCCUPY) {
+            newfs_bcache_unhash(bufs[i]);
+            bufs[i]->flag = 0;
+        }
+        newfs_bcache_lru_del(bufs[i]);
+        newfs_bcache_lru_add(bufs[i]);
+    }
+    return cnt;
+}
+/**
+ * @brief 预读：把从blkno起连续cnt个块中未缓存的部分读入块缓存，已缓存的块保持原样。
+ * 每批至多 NEWFS_DEV_BATCH 块，相邻的未缓存块合并为一段，一批一起提交。只使用干净的缓冲块，用完即停止。
+ * 持锁取得缓冲块并登记为读入中（LOADING），放开锁提交，读完再持锁发布，其他线程查找这些块时等待。
+ * 收集一批时不等待其他线程正在读入的块，视为已缓存跳过，从判断未缓存到登记之间不放开锁
+ *
+ * @param blkno 起始块号
+ * @param cnt 块数，不应超过缓存容量的一半，否则后读入的块会淘汰先读入的块
+ * @return int
+ */
+int newfs_bcache_prefetch(int blkno, int cnt) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf*    bufs[NEWFS_DEV_BATCH];
+    uint8_t*             blks[NEWFS_DEV_BATCH];
+    struct newfs_dev_req reqs[NEWFS_DEV_BATCH];
+    int      i = 0;
+    int      n, nreq, got, j, k, m;
+    int      ret = NEWFS_ERROR_NONE;
+
+    NEWFS_BCACHE_LOCK();
+    while (i < cnt) {
+        for (n = 0, nreq = 0; i < cnt && n < NEWFS_DEV_BATCH; i++) {   /* 收集一批未缓存的块 */
+            if (newfs_bcache_find(blkno + i) != NULL) {
+                continue;
+            }
+            if (nreq == 0 || reqs[nreq - 1].offset + (off_t)reqs[nreq - 1].cnt * NEWFS_BLK_SZ() !=
+                             NEWFS_BLK_OFS((off_t)(blkno + i))) {
+                reqs[nreq].offset   = NEWFS_BLK_OFS((off_t)(blkno + i));
+                reqs[nreq].bufs     = &blks[n];
+                reqs[nreq].cnt      = 0;
+                reqs[nreq].is_write = FALSE;
+                nreq++;
+            }
+            reqs[nreq - 1].cnt++;
+            n++;
+        }
+        got = newfs_bcache_take_clean(bufs, n);       /* 整批一次取得，同一缓冲块不会分给两段 */
+        for (j = 0, k = 0; j < nreq && k < got; k += reqs[j++].cnt) {
+            if (reqs[j].cnt > got - k) {
+                reqs[j].cnt = got - k;
+            }
+        }
+        nreq = j;
+        for (j = 0, k = 0; j < nreq; j++) {
+            for (m = 0; m < reqs[j].cnt; m++, k++) {
+                blks[k] = bufs[k]->data;
+                newfs_bcache_insert(bufs[k], (int)(reqs[j].offset / NEWFS_BLK_SZ()) + m);
+                bufs[k]->flag |= NEWFS_FLAG_BUF_LOADING;
+            }
+        }
+        if (nreq > 0) {
+            NEWFS_BCACHE_UNLOCK();
+            ret = newfs_dev_submit(reqs, nreq);
+            NEWFS_BCACHE_LOCK();
+        }
+        for (j = 0; j < got; j++) {
+            if (ret == NEWFS_ERROR_NONE) {
+                bufs[j]->flag &= ~NEWFS_FLAG_BUF_LOADING;
+            }
+            else {
+                newfs_bcache_unhash(bufs[j]);
+                bufs[j]->blkno = -1;
+                bufs[j]->flag  = 0;
+            }
+        }
+        pthread_cond_broadcast(&bcache->io_done);
+        if (ret != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error, blkno %d\n", __func__, (int)(reqs[0].offset / NEWFS_BLK_SZ()));
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        bcache->prefetched += got;
+        if (got < n) {                                /* 干净的缓冲块不够 */
+            break;
+        }
+    }
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 标记缓冲块为脏，淘汰或刷写时回写
+ *
+ * @param buf
+ */
+void newfs_bcache_mark_dirty(struct newfs_buf* buf) {
+    if (!(buf->flag & NEWFS_FLAG_BUF_DIRTY)) {
+        buf->flag |= NEWFS_FLAG_BUF_DIRTY;
+        newfs_mark_dirty(NEWFS_BLK_SZ());
+    }
+}
+static int newfs_bcache_cmp(const void* a, const void* b) {
+    return (*(struct newfs_buf**)a)->blkno - (*(struct newfs_buf**)b)->blkno;
+}
+/**
+ * @brief 收集带有flag中任一标志的缓冲块（包括临时增加的），按块号排序放入 bcache->sorted，
+ * 调用者持有 NEWFS_BCACHE_LOCK
+ *
+ * @param flag
+ * @return int 块数
+ */
+int newfs_bcache_collect(int flag) {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf*    buf;
+    int      n = 0;
+    int      i;
+
+    for (i = 0; i < bcache->nbufs; i++) {
+        if (bcache->bufs[i].flag & flag) {
+            bcache->sorted[n++] = &bcache->bufs[i];
+        }
+    }
+    for (buf = bcache->extra; buf != NULL; buf = buf->extra_next) {
+        if (buf->flag & flag) {
+            bcache->sorted[n++] = buf;
+        }
+    }
+    qsort(bcache->sorted, n, sizeof(struct newfs_buf*), newfs_bcache_cmp);
+    return n;
+}
+/**
+ * @brief 将按块号排好序的缓冲块写回原位置，相邻的块合并为一段连续写，每 NEWFS_DEV_BATCH 块一起提交，
+ * 调用者持有 NEWFS_BCACHE_LOCK
+ *
+ * @param bufs
+ * @param n
+ * @return int
+ */
+int newfs_bcache_write_runs(struct newfs_buf** bufs, int n) {
+    uint8_t*             blks[NEWFS_DEV_BATCH];
+    struct newfs_dev_req reqs[NEWFS_DEV_BATCH];
+    int      i, j, k, nreq;
+
+    for (i = 0; i < n; i += k) {
+        for (k = 0, nreq = 0; i + k < n && k < NEWFS_DEV_BATCH; k++) {
+            if (k == 0 || bufs[i + k]->blkno != bufs[i + k - 1]->blkno + 1) {
+                reqs[nreq].offset   = NEWFS_BLK_OFS((off_t)bufs[i + k]->blkno);
+                reqs[nreq].bufs     = &blks[k];
+                reqs[nreq].cnt      = 0;
+                reqs[nreq].is_write = TRUE;
+                nreq++;
+            }
+            reqs[nreq - 1].cnt++;
+            blks[k] = bufs[i + k]->data;
+        }
+        if (newfs_dev_submit(reqs, nreq) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error, blkno %d\n", __func__, bufs[i]->blkno);
+            return -NEWFS_ERROR_IO;
+        }
+        for (j = 0; j < k; j++) {
+            bufs[i + j]->flag &= ~(NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED);
+        }
+        NEWFS_BCACHE()->writebacks += k;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 回写所有脏缓冲块（包括已提交到日志的块），按块号排序后相邻的块合并为一次连续写
+ *
+ * @return int
+ */
+int newfs_bcache_flush() {
+    int      n;
+    int      ret;
+
+    NEWFS_BCACHE_LOCK();
+    n   = newfs_bcache_collect(NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED);
+    ret = newfs_bcache_write_runs(NEWFS_BCACHE()->sorted, n);
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 提交落盘后释放临时增加的缓冲块，已记录的块先写回原位置，调用者持有 NEWFS_BCACHE_LOCK。
+ * 仍然为脏或正在读入的块留到下一次提交后
+ *
+ * @return int
+ */
+int newfs_bcache_shrink() {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf**   pprev;
+    struct newfs_buf*    buf;
+    int      n = 0;
+
+    for (buf = bcache->extra; buf != NULL; buf = buf->extra_next) {
+        if ((buf->flag & (NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED | NEWFS_FLAG_BUF_LOADING)) == NEWFS_FLAG_BUF_LOGGED) {
+            bcache->sorted[n++] = buf;
+        }
+    }
+    qsort(bcache->sorted, n, sizeof(struct newfs_buf*), newfs_bcache_cmp);
+    if (newfs_bcache_write_runs(bcache->sorted, n) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    pprev = &bcache->extra;
+    while ((buf = *pprev) != NULL) {
+        if (buf->flag & (NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_LOGGED | NEWFS_FLAG_BUF_LOADING)) {
+            pprev = &buf->extra_next;
+            continue;
+        }
+        if (buf->flag & NEWFS_FLAG_BUF_OCCUPY) {
+            newfs_bcache_unhash(buf);
+        }
+        newfs_bcache_lru_del(buf);
+        *pprev = buf->extra_next;
+        free(buf->data);
+        free(buf);
+        bcache->nextra--;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放块缓存，调用前需先 newfs_bcache_flush
+ *
+ */
+void newfs_bcache_destroy() {
+    struct newfs_bcache* bcache = NEWFS_BCACHE();
+    struct newfs_buf*    buf;
+    NEWFS_DBG("[%s] hits %d, misses %d, writebacks %d, prefetched %d\n", __func__,
+              bcache->hits, bcache->misses, bcache->writebacks, bcache->prefetched);
+    if (newfs_super.dev->register_mem != NULL) {
+        newfs_super.dev->register_mem(NEWFS_DRIVER(), NULL, 0);
+    }
+    while ((buf = bcache->extra) != NULL) {
+        bcache->extra = buf->extra_next;
+        free(buf->data);
+        free(buf);
+    }
+    free(bcache->arena);
+    free(bcache->bufs);
+    free(bcache->hash);
+    free(bcache->sorted);
+    pthread_mutex_destroy(&bcache->lock);
+    pthread_cond_destroy(&bcache->io_done);
+    memset(bcache, 0, sizeof(struct newfs_bcache));
+}
@@ -0,0 +1,168 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_DCACHE()                    (&newfs_super.dcache)
+
+/**
+ * @brief 初始化路径缓存
+ *
+ * @return int
+ */
+int newfs_dcache_init() {
+    struct newfs_dcache* dcache = NEWFS_DCACHE();
+    memset(dcache, 0, sizeof(struct newfs_dcache));
+    dcache->nbuckets = NEWFS_DCACHE_MAX * 2;
+    dcache->buckets  = (struct newfs_dcache_entry**)calloc(dcache->nbuckets,
+                                                           sizeof(struct newfs_dcache_entry*));
+    if (dcache->buckets == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_init(&dcache->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 清空路径缓存中的所有项
+ *
+ */
+static void newfs_dcache_clear() {
+    struct newfs_dcache*       dcache = NEWFS_DCACHE();
+    struct newfs_dcache_entry* entry;
+    int i;
+    for (i = 0; i < dcache->nbuckets; i++) {
+        while ((entry = dcache->buckets[i]) != NULL) {
+            dcache->buckets[i] = entry->next;
+            free(entry->path);
+            free(entry);
+        }
+    }
+    dcache->count = 0;
+}
+/**
+ * @brief 释放路径缓存
+ *
+ */
+void newfs_dcache_destroy() {
+    struct newfs_dcache* dcache = NEWFS_DCACHE();
+    if (dcache->buckets == NULL) {
+        return;
+    }
+    NEWFS_DBG("[%s] hits %d, misses %d\n", __func__, dcache->hits, dcache->misses);
+    newfs_dcache_clear();
+    free(dcache->buckets);
+    dcache->buckets = NULL;
+    pthread_mutex_destroy(&dcache->lock);
+}
+/**
+ * @brief 查找路径，一次哈希探测
+ *
+ * @param path 完整路径
+ * @param is_find 输出，路径是否存在
+ * @return struct newfs_dentry* 未命中返回NULL；命中时与 newfs_lookup 的返回值相同
+ */
+struct newfs_dentry* newfs_dcache_lookup(const char* path, boolean* is_find) {
+    struct newfs_dcache*       dcache = NEWFS_DCACHE();
+    struct newfs_dcache_entry* entry;
+    struct newfs_dentry*       dentry = NULL;
+    uint32_t hash = newfs_hash_name(path);
+
+    pthread_mutex_lock(&dcache->lock);
+    entry = dcache->buckets[hash % dcache->nbuckets];
+    while (entry) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            if (!entry->is_find && entry->gen != dcache->neg_gen) {
+                break;                                /* 负项已过期 */
+            }
+            *is_find = entry->is_find;
+            dentry   = entry->dentry;
+            break;
+        }
+        entry = entry->next;
+    }
+    if (dentry != NULL) {
+        dcache->hits++;
+    }
+    else {
+        dcache->misses++;
+    }
+    pthread_mutex_unlock(&dcache->lock);
+    return dentry;
+}
+/**
+ * @brief 记录一次 newfs_lookup 的结果
+ *
+ * @param path 完整路径
+ * @param dentry newfs_lookup的返回值
+ * @param is_find 路径是否存在
+ */
+void newfs_dcache_add(const char* path, struct newfs_dentry* dentry, boolean is_find) {
+    struct newfs_dcache*        dcache = NEWFS_DCACHE();
+    struct newfs_dcache_entry*  entry;
+    uint32_t hash = newfs_hash_name(path);
+    int      bucket = hash % dcache->nbuckets;
+
+    pthread_mutex_lock(&dcache->lock);
+    for (entry = dcache->buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            break;                                    /* 覆盖过期的项 */
+        }
+    }
+    if (entry == NULL) {
+        if (dcache->count >= NEWFS_DCACHE_MAX) {
+            newfs_dcache_clear();
+        }
+        entry = (struct newfs_dcache_entry*)malloc(sizeof(struct newfs_dcache_entry));
+        if (entry == NULL) {
+            pthread_mutex_unlock(&dcache->lock);
+            return;
+        }
+        entry->path = strdup(path);
+        entry->hash = hash;
+        entry->next = dcache->buckets[bucket];
+        dcache->buckets[bucket] = entry;
+        dcache->count++;
+    }
+    entry->dentry  = dentry;
+    entry->is_find = is_find;
+    entry->gen     = dcache->neg_gen;
+    pthread_mutex_unlock(&dcache->lock);
+}
+/**
+ * @brief 创建了新的目录项：所有负项（包括记录的最深祖先）都可能过期
+ *
+ */
+void newfs_dcache_invalidate_neg() {
+    pthread_mutex_lock(&NEWFS_DCACHE()->lock);
+    NEWFS_DCACHE()->neg_gen++;
+    pthread_mutex_unlock(&NEWFS_DCACHE()->lock);
+}
+/**
+ * @brief 删除或重命名path：移除path及其下所有路径的缓存项，并使所有负项过期
+ *
+ * @param path 完整路径
+ */
+void newfs_dcache_invalidate(const char* path) {
+    struct newfs_dcache*        dcache = NEWFS_DCACHE();
+    struct newfs_dcache_entry** pprev;
+    struct newfs_dcache_entry*  entry;
+    int len = strlen(path);
+    int i;
+
+    pthread_mutex_lock(&dcache->lock);
+    for (i = 0; i < dcache->nbuckets; i++) {
+        pprev = &dcache->buckets[i];
+        while ((entry = *pprev) != NULL) {
+            if (strncmp(entry->path, path, len) == 0 &&
+                (entry->path[len] == '\0' || entry->path[len] == '/')) {
+                *pprev = entry->next;
+                free(entry->path);
+                free(entry);
+                dcache->count--;
+                continue;
+            }
+            pprev = &entry->next;
+        }
+    }
+    dcache->neg_gen++;
+    pthread_mutex_unlock(&dcache->lock);
+}
@@ -0,0 +1,767 @@
+#define _GNU_SOURCE                                 /* O_DIRECT */
+#include "../include/newfs.h"
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+#ifdef NEWFS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * 块设备后端。文件系统只通过 struct newfs_dev_ops 访问设备，--backend 选择：
+ *   ddriver：课程提供的模拟磁盘，seek与读写须成对执行，所有访问经设备锁串行；
+ *   file：普通镜像文件或块设备，按偏移读写（preadv/pwritev），不需要锁，多个线程可以同时访问。
+ *         --direct 以O_DIRECT打开，绕过页缓存，内存或长度不按IO单位对齐时经对齐的中转缓冲。
+ *   uring：与file相同的镜像文件，批量提交经io_uring，同时保持至多 --uring_depth 个请求在途；
+ *          块缓存的内存登记为固定缓冲，缓存块的读写不必每次映射用户内存。编译时需要 linux/io_uring.h。
+ * 本文件不引用newfs_super，mkfs.newfs 同样使用。
+ */
+
+static pthread_mutex_t newfs_ddriver_lock = PTHREAD_MUTEX_INITIALIZER;   /* seek与后续读写之间不能插入其他线程的访问 */
+static int             newfs_ddriver_io_sz;
+
+/**
+ * @brief 打开ddriver设备，ddriver没有直接IO和队列，is_direct、depth被忽略
+ *
+ * @param path
+ * @param is_direct
+ * @param depth
+ * @return int 设备句柄，失败返回错误码
+ */
+static int newfs_ddriver_open(const char* path, boolean is_direct, int depth) {
+    int fd = ddriver_open((char *)path);
+    (void)is_direct;
+    (void)depth;
+
+    if (fd < 0) {
+        return -NEWFS_ERROR_IO;
+    }
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &newfs_ddriver_io_sz);
+    return fd;
+}
+/**
+ * @brief ddriver读写：一次seek后按IO单位依次读写，见 struct newfs_dev_ops 的 pread/pwrite
+ *
+ * @param fd
+ * @param bufs
+ * @param cnt
+ * @param sz 每段长度，IO单位的整数倍
+ * @param offset
+ * @param is_write
+ * @return int
+ */
+static int newfs_ddriver_rw(int fd, uint8_t** bufs, int cnt, int sz, off_t offset, boolean is_write) {
+    int      i, done;
+    int      ret = NEWFS_ERROR_NONE;
+
+    pthread_mutex_lock(&newfs_ddriver_lock);
+    if (ddriver_seek(fd, offset, SEEK_SET) < 0) {
+        ret = -NEWFS_ERROR_SEEK;
+    }
+    for (i = 0; ret == NEWFS_ERROR_NONE && i < cnt; i++) {
+        for (done = 0; done < sz; done += newfs_ddriver_io_sz) {
+            if ((is_write ? ddriver_write(fd, (char *)bufs[i] + done, newfs_ddriver_io_sz)
+                          : ddriver_read(fd, (char *)bufs[i] + done, newfs_ddriver_io_sz)) < 0) {
+                ret = -NEWFS_ERROR_IO;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&newfs_ddriver_lock);
+    return ret;
+}
+static int newfs_ddriver_pread(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    return newfs_ddriver_rw(fd, bufs, cnt, sz, offset, FALSE);
+}
+static int newfs_ddriver_pwrite(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    return newfs_ddriver_rw(fd, bufs, cnt, sz, offset, TRUE);
+}
+/**
+ * @brief 没有队列的后端逐段执行批量请求
+ *
+ * @param fd
+ * @param reqs
+ * @param n
+ * @param sz
+ * @param rw 后端的单段读写
+ * @return int
+ */
+static int newfs_dev_submit_each(int fd, struct newfs_dev_req* reqs, int n, int sz,
+                                 int (*rw)(int, uint8_t**, int, int, off_t, boolean)) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (rw(fd, reqs[i].bufs, reqs[i].cnt, sz, reqs[i].offset, reqs[i].is_write) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+static int newfs_ddriver_submit(int fd, struct newfs_dev_req* reqs, int n, int sz) {
+    return newfs_dev_submit_each(fd, reqs, n, sz, newfs_ddriver_rw);
+}
+/**
+ * @brief ddriver没有缓存，写入即落盘
+ *
+ * @param fd
+ * @return int
+ */
+static int newfs_ddriver_flush(int fd) {
+    (void)fd;
+    return NEWFS_ERROR_NONE;
+}
+static int newfs_ddriver_size(int fd) {
+    int sz = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &sz);
+    return sz;
+}
+static int newfs_ddriver_io_size(int fd) {
+    int sz = 0;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &sz);
+    return sz;
+}
+static void newfs_ddriver_close(int fd) {
+    ddriver_close(fd);
+}
+
+/**
+ * @brief 块设备的逻辑扇区大小，普通文件按512字节
+ *
+ * @param fd
+ * @return int
+ */
+static int newfs_file_dev_io_size(int fd) {
+    struct stat st;
+    int sz;
+
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode) && ioctl(fd, BLKSSZGET, &sz) == 0) {
+        return sz;
+    }
+    return 512;
+}
+static struct {                                     // 打开时确定的访问方式，只支持同时打开一个设备
+    boolean            is_direct;                   // 以O_DIRECT打开
+    int                align;                       // O_DIRECT要求内存地址、长度和偏移对齐到的字节数
+} newfs_file_dev = { .is_direct = FALSE, .align = 1 };
+
+/**
+ * @brief 打开镜像文件或块设备，记下是否O_DIRECT及其对齐要求，读写时不再查询
+ *
+ * @param path
+ * @param is_direct 以O_DIRECT打开
+ * @param depth 没有队列，被忽略
+ * @return int 文件描述符，失败返回错误码
+ */
+static int newfs_file_dev_open(const char* path, boolean is_direct, int depth) {
+    int fd = open(path, O_RDWR | (is_direct ? O_DIRECT : 0));
+    (void)depth;
+
+    if (fd < 0) {
+        return errno == EINVAL ? -NEWFS_ERROR_UNSUPPORTED : -errno;   /* 文件系统不支持O_DIRECT时为EINVAL */
+    }
+    newfs_file_dev.is_direct = is_direct;
+    newfs_file_dev.align     = is_direct ? newfs_file_dev_io_size(fd) : 1;
+    return fd;
+}
+/**
+ * @brief 设备字节数。newfs以int表示偏移，超过2GB的部分不使用
+ *
+ * @param fd
+ * @return int
+ */
+static int newfs_file_dev_size(int fd) {
+    struct stat st;
+    uint64_t    sz;
+
+    if (fstat(fd, &st) != 0) {
+        return 0;
+    }
+    sz = (uint64_t)st.st_size;
+    if (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &sz) != 0) {
+        return 0;
+    }
+    if (sz > (uint64_t)INT32_MAX) {
+        sz = (uint64_t)INT32_MAX / NEWFS_FILE_ALIGN_MAX * NEWFS_FILE_ALIGN_MAX;
+    }
+    return (int)sz;
+}
+/**
+ * @brief 按偏移的分散/聚集读写，短读写时继续，直到全部完成
+ *
+ * @param fd
+ * @param iov 会被修改
+ * @param iovcnt
+ * @param offset
+ * @param is_write
+ * @return int
+ */
+static int newfs_file_dev_rwv(int fd, struct iovec* iov, int iovcnt, off_t offset, boolean is_write) {
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        n = is_write ? pwritev(fd, iov, iovcnt, offset) : preadv(fd, iov, iovcnt, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {                                 /* 读到设备末尾之后同样视为错误 */
+            return -NEWFS_ERROR_IO;
+        }
+        offset += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 访问是否满足O_DIRECT的对齐要求：内存地址、长度和偏移按IO单位对齐
+ *
+ * @param fd
+ * @param bufs
+ * @param cnt
+ * @param sz
+ * @param offset
+ * @return boolean 未以O_DIRECT打开时总是TRUE
+ */
+static boolean newfs_file_dev_aligned(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    int align = newfs_file_dev.align;
+    int i;
+    (void)fd;
+
+    if (!newfs_file_dev.is_direct) {
+        return TRUE;
+    }
+    for (i = 0; i < cnt; i++) {
+        if ((uintptr_t)bufs[i] % align != 0) {
+            return FALSE;
+        }
+    }
+    return sz % align == 0 && offset % align == 0;
+}
+/**
+ * @brief 镜像文件读写：每 NEWFS_IOV_MAX_RUN 段合并为一次preadv/pwritev，不满足O_DIRECT的对齐要求时
+ * 经一块对齐的中转缓冲
+ *
+ * @param fd
+ * @param bufs
+ * @param cnt
+ * @param sz
+ * @param offset
+ * @param is_write
+ * @return int
+ */
+static int newfs_file_dev_rw(int fd, uint8_t** bufs, int cnt, int sz, off_t offset, boolean is_write) {
+    struct iovec iov[NEWFS_IOV_MAX_RUN];
+    uint8_t* bounce = NULL;
+    int      i, n;
+    int      ret = NEWFS_ERROR_NONE;
+
+    if (!newfs_file_dev_aligned(fd, bufs, cnt, sz, offset) &&
+        posix_memalign((void **)&bounce, NEWFS_FILE_ALIGN_MAX, (size_t)NEWFS_IOV_MAX_RUN * sz) != 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (; ret == NEWFS_ERROR_NONE && cnt > 0; bufs += n, cnt -= n, offset += (off_t)n * sz) {
+        n = cnt < NEWFS_IOV_MAX_RUN ? cnt : NEWFS_IOV_MAX_RUN;
+        if (bounce == NULL) {
+            for (i = 0; i < n; i++) {
+                iov[i].iov_base = bufs[i];
+                iov[i].iov_len  = sz;
+            }
+            ret = newfs_file_dev_rwv(fd, iov, n, offset, is_write);
+            continue;
+        }
+        for (i = 0; is_write && i < n; i++) {
+            memcpy(bounce + (size_t)i * sz, bufs[i], sz);
+        }
+        iov[0].iov_base = bounce;
+        iov[0].iov_len  = (size_t)n * sz;
+        ret = newfs_file_dev_rwv(fd, iov, 1, offset, is_write);
+        for (i = 0; ret == NEWFS_ERROR_NONE && !is_write && i < n; i++) {
+            memcpy(bufs[i], bounce + (size_t)i * sz, sz);
+        }
+    }
+    free(bounce);
+    return ret;
+}
+static int newfs_file_dev_pread(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    return newfs_file_dev_rw(fd, bufs, cnt, sz, offset, FALSE);
+}
+static int newfs_file_dev_pwrite(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    return newfs_file_dev_rw(fd, bufs, cnt, sz, offset, TRUE);
+}
+static int newfs_file_dev_submit(int fd, struct newfs_dev_req* reqs, int n, int sz) {
+    return newfs_dev_submit_each(fd, reqs, n, sz, newfs_file_dev_rw);
+}
+static int newfs_file_dev_flush(int fd) {
+    return fdatasync(fd) == 0 ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+}
+/**
+ * @brief 镜像文件可由FUSE按偏移直接读出；O_DIRECT打开时内核splice不满足对齐要求，不提供
+ *
+ * @param fd
+ * @return int
+ */
+static int newfs_file_dev_splice_fd(int fd) {
+    return newfs_file_dev.is_direct ? -1 : fd;
+}
+static void newfs_file_dev_close(int fd) {
+    newfs_file_dev.is_direct = FALSE;
+    newfs_file_dev.align     = 1;
+    close(fd);
+}
+
+#ifdef NEWFS_HAVE_IO_URING
+struct newfs_uring_op {                             // 一个SQE：一段连续访问，出错或短读写时据此同步重做
+    struct iovec*      iov;
+    int                iovcnt;
+    size_t             len;                         // 期望完成的字节数
+    off_t              offset;
+    boolean            is_write;
+    boolean            is_fixed;                    // 单块且位于固定缓冲内，用READ_FIXED/WRITE_FIXED
+    boolean            is_done;                     // 已收割
+};
+
+static struct {
+    int                fd;                          // io_uring实例，只支持同时打开一个设备
+    unsigned           depth;                       // 在途请求上限，即提交队列长度
+    unsigned*          sq_head;
+    unsigned*          sq_tail;
+    unsigned*          sq_mask;
+    unsigned*          sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned*          cq_head;
+    unsigned*          cq_tail;
+    unsigned*          cq_mask;
+    struct io_uring_cqe* cqes;
+    void*              sq_ring;
+    size_t             sq_len;
+    void*              cq_ring;
+    size_t             cq_len;
+    size_t             sqes_len;
+    boolean            is_direct;
+    boolean            is_broken;                   // io_uring_enter失败，环已撤销，此后全部按偏移同步读写
+    uint8_t*           reg_base;                    // 登记的固定缓冲
+    size_t             reg_len;
+    struct iovec*      iovs;                        // 批量提交的临时数组，按需扩大
+    struct newfs_uring_op* ops;
+    int                cap;
+
+    int                sqes_cnt;                    // 提交的SQE数
+    int                enters;                      // io_uring_enter次数
+    int                retries;                     // 同步重做的SQE数
+    int                waits;                       // 环被其他线程占用而等待的批量请求数
+    pthread_mutex_t    lock;                        // 提交与收割在同一线程内完成，期间独占环
+} newfs_uring = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief 撤销环的映射并关闭io_uring实例
+ *
+ */
+static void newfs_uring_teardown() {
+    if (newfs_uring.sq_ring != NULL && newfs_uring.sq_ring != MAP_FAILED) {
+        munmap(newfs_uring.sq_ring, newfs_uring.sq_len);
+    }
+    if (newfs_uring.cq_ring != NULL && newfs_uring.cq_ring != MAP_FAILED) {
+        munmap(newfs_uring.cq_ring, newfs_uring.cq_len);
+    }
+    if (newfs_uring.sqes != NULL && newfs_uring.sqes != MAP_FAILED) {
+        munmap(newfs_uring.sqes, newfs_uring.sqes_len);
+    }
+    if (newfs_uring.fd >= 0) {
+        close(newfs_uring.fd);                        /* 同时撤销登记的固定缓冲 */
+    }
+    free(newfs_uring.iovs);
+    free(newfs_uring.ops);
+    newfs_uring.fd       = -1;
+    newfs_uring.sq_ring  = NULL;
+    newfs_uring.cq_ring  = NULL;
+    newfs_uring.sqes     = NULL;
+    newfs_uring.reg_base = NULL;
+    newfs_uring.reg_len  = 0;
+    newfs_uring.iovs     = NULL;
+    newfs_uring.ops      = NULL;
+    newfs_uring.cap      = 0;
+}
+/**
+ * @brief 打开镜像文件并建立深度为depth的io_uring
+ *
+ * @param path
+ * @param is_direct 以O_DIRECT打开
+ * @param depth 在途请求上限，0取 NEWFS_URING_DEPTH，内核会向上取整到2的幂
+ * @return int 文件描述符，内核不支持io_uring时返回 -NEWFS_ERROR_UNSUPPORTED
+ */
+static int newfs_uring_open(const char* path, boolean is_direct, int depth) {
+    struct io_uring_params p;
+    uint8_t* sq;
+    uint8_t* cq;
+    int fd = newfs_file_dev_open(path, is_direct, depth);
+
+    if (fd < 0) {
+        return fd;
+    }
+    depth = depth > 0 ? depth : NEWFS_URING_DEPTH;
+    depth = depth < NEWFS_URING_DEPTH_MAX ? depth : NEWFS_URING_DEPTH_MAX;
+    memset(&p, 0, sizeof(p));
+    newfs_uring.fd = syscall(__NR_io_uring_setup, depth, &p);
+    if (newfs_uring.fd < 0) {
+        NEWFS_DBG("[%s] io_uring_setup: %s\n", __func__, strerror(errno));
+        newfs_file_dev_close(fd);
+        return -NEWFS_ERROR_UNSUPPORTED;
+    }
+    newfs_uring.sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    newfs_uring.cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    newfs_uring.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    newfs_uring.sq_ring  = mmap(NULL, newfs_uring.sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                newfs_uring.fd, IORING_OFF_SQ_RING);
+    newfs_uring.cq_ring  = mmap(NULL, newfs_uring.cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                newfs_uring.fd, IORING_OFF_CQ_RING);
+    newfs_uring.sqes     = mmap(NULL, newfs_uring.sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                newfs_uring.fd, IORING_OFF_SQES);
+    if (newfs_uring.sq_ring == MAP_FAILED || newfs_uring.cq_ring == MAP_FAILED || newfs_uring.sqes == MAP_FAILED) {
+        newfs_uring_teardown();
+        newfs_file_dev_close(fd);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    sq = newfs_uring.sq_ring;
+    cq = newfs_uring.cq_ring;
+    newfs_uring.sq_head   = (unsigned *)(sq + p.sq_off.head);
+    newfs_uring.sq_tail   = (unsigned *)(sq + p.sq_off.tail);
+    newfs_uring.sq_mask   = (unsigned *)(sq + p.sq_off.ring_mask);
+    newfs_uring.sq_array  = (unsigned *)(sq + p.sq_off.array);
+    newfs_uring.cq_head   = (unsigned *)(cq + p.cq_off.head);
+    newfs_uring.cq_tail   = (unsigned *)(cq + p.cq_off.tail);
+    newfs_uring.cq_mask   = (unsigned *)(cq + p.cq_off.ring_mask);
+    newfs_uring.cqes      = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    newfs_uring.depth     = p.sq_entries;             /* 完成队列至少是它的两倍，不会溢出 */
+    newfs_uring.is_direct = is_direct;
+    newfs_uring.is_broken = FALSE;
+    newfs_uring.sqes_cnt  = 0;
+    newfs_uring.enters    = 0;
+    newfs_uring.retries   = 0;
+    newfs_uring.waits     = 0;
+    return fd;
+}
+/**
+ * @brief 把[base, base + len)登记为固定缓冲，此后落在其中的单块读写不必每次映射用户内存
+ *
+ * @param fd
+ * @param base NULL表示撤销
+ * @param len
+ * @return int 登记失败（如超过RLIMIT_MEMLOCK）时返回错误，读写照常进行
+ */
+static int newfs_uring_register_mem(int fd, uint8_t* base, size_t len) {
+    struct iovec iov;
+    int ret = NEWFS_ERROR_NONE;
+    (void)fd;
+
+    pthread_mutex_lock(&newfs_uring.lock);
+    if (newfs_uring.reg_base != NULL) {
+        syscall(__NR_io_uring_register, newfs_uring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        newfs_uring.reg_base = NULL;
+        newfs_uring.reg_len  = 0;
+    }
+    if (base != NULL) {
+        iov.iov_base = base;
+        iov.iov_len  = len;
+        if (syscall(__NR_io_uring_register, newfs_uring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+            newfs_uring.reg_base = base;
+            newfs_uring.reg_len  = len;
+        }
+        else {
+            NEWFS_DBG("[%s] io_uring_register: %s\n", __func__, strerror(errno));
+            ret = -NEWFS_ERROR_UNSUPPORTED;
+        }
+    }
+    pthread_mutex_unlock(&newfs_uring.lock);
+    return ret;
+}
+/**
+ * @brief 把一个访问放入提交队列，调用者持有环并保证队列未满
+ *
+ * @param fd
+ * @param op
+ * @param idx 完成时据此找回op
+ */
+static void newfs_uring_queue(int fd, struct newfs_uring_op* op, int idx) {
+    unsigned tail = *newfs_uring.sq_tail;
+    unsigned slot = tail & *newfs_uring.sq_mask;
+    struct io_uring_sqe* sqe = &newfs_uring.sqes[slot];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->fd  = fd;
+    sqe->off = op->offset;
+    if (op->is_fixed) {
+        sqe->opcode    = op->is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr      = (uintptr_t)op->iov->iov_base;
+        sqe->len       = op->len;
+        sqe->buf_index = 0;
+    }
+    else {
+        sqe->opcode    = op->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr      = (uintptr_t)op->iov;
+        sqe->len       = op->iovcnt;
+    }
+    sqe->user_data = idx;
+    newfs_uring.sq_array[slot] = slot;
+    __atomic_store_n(newfs_uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    newfs_uring.sqes_cnt++;
+}
+/**
+ * @brief 收割已完成的访问。出错或短读写的访问按偏移同步重做
+ *
+ * @param fd
+ * @param ret 重做失败时置为错误码
+ * @return int 收割的个数
+ */
+static int newfs_uring_reap(int fd, int* ret) {
+    struct io_uring_cqe*   cqe;
+    struct newfs_uring_op* op;
+    unsigned head = *newfs_uring.cq_head;
+    int      cnt  = 0;
+
+    while (head != __atomic_load_n(newfs_uring.cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &newfs_uring.cqes[head & *newfs_uring.cq_mask];
+        op  = &newfs_uring.ops[cqe->user_data];
+        if (cqe->res < 0 || (size_t)cqe->res != op->len) {
+            newfs_uring.retries++;
+            if (newfs_file_dev_rwv(fd, op->iov, op->iovcnt, op->offset, op->is_write) != NEWFS_ERROR_NONE) {
+                *ret = -NEWFS_ERROR_IO;
+            }
+        }
+        op->is_done = TRUE;
+        head++;
+        cnt++;
+    }
+    __atomic_store_n(newfs_uring.cq_head, head, __ATOMIC_RELEASE);
+    return cnt;
+}
+/**
+ * @brief 确保临时数组能容纳cnt块，调用者持有环
+ *
+ * @param cnt
+ * @return int
+ */
+static int newfs_uring_reserve(int cnt) {
+    struct iovec*          iovs;
+    struct newfs_uring_op* ops;
+
+    if (cnt <= newfs_uring.cap) {
+        return NEWFS_ERROR_NONE;
+    }
+    iovs = (struct iovec*)realloc(newfs_uring.iovs, cnt * sizeof(struct iovec));
+    if (iovs != NULL) {
+        newfs_uring.iovs = iovs;
+    }
+    ops = (struct newfs_uring_op*)realloc(newfs_uring.ops, cnt * sizeof(struct newfs_uring_op));
+    if (ops != NULL) {
+        newfs_uring.ops = ops;
+    }
+    if (iovs == NULL || ops == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_uring.cap = cnt;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief io_uring_enter失败后的收尾，调用者持有环：内核已取走的SQE都要等到完成事件，
+ * 在途的访问与同步重做不会交错，也不会在缓冲块另作他用后才写入；等待不设时限。
+ * 尚在提交队列中、未被取走的SQE随环撤销，不会再执行。未完成的访问随后按偏移同步重做，此后全部按偏移同步读写
+ *
+ * @param fd
+ * @param nops 本批的访问数
+ * @param sq_base 本批提交前的提交队列头
+ * @param reaped 本批已收割的个数
+ * @return int
+ */
+static int newfs_uring_abort(int fd, int nops, unsigned sq_base, int reaped) {
+    struct newfs_uring_op* op;
+    int      ret = NEWFS_ERROR_NONE;
+    int      i;
+
+    while ((int)(__atomic_load_n(newfs_uring.sq_head, __ATOMIC_ACQUIRE) - sq_base) > reaped) {
+        if (syscall(__NR_io_uring_enter, newfs_uring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            usleep(1000);                             /* 返回用户态时内核补上完成事件 */
+        }
+        reaped += newfs_uring_reap(fd, &ret);
+    }
+    for (i = 0; i < nops; i++) {
+        op = &newfs_uring.ops[i];
+        if (!op->is_done) {
+            newfs_uring.retries++;
+            if (newfs_file_dev_rwv(fd, op->iov, op->iovcnt, op->offset, op->is_write) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+        }
+    }
+    newfs_uring.is_broken = TRUE;
+    newfs_uring_teardown();
+    return ret;
+}
+/**
+ * @brief 批量访问：每段连续访问拆成SQE（固定缓冲内的块各一个READ_FIXED/WRITE_FIXED，其余每段一个READV/WRITEV），
+ * 保持至多depth个在途，每收割一批即补充，全部完成后返回。
+ * 各线程的批量访问依次独占环，环被占用时等待；O_DIRECT下不对齐的段经file后端的中转缓冲。
+ * io_uring_enter失败时撤销环，未完成的访问同步重做，重做成功则本次调用仍然成功；此后只按偏移同步读写
+ *
+ * @param fd
+ * @param reqs
+ * @param n
+ * @param sz 每块字节数
+ * @return int
+ */
+static int newfs_uring_submit(int fd, struct newfs_dev_req* reqs, int n, int sz) {
+    struct newfs_uring_op* op = NULL;
+    int      total, nops, next, inflight, reaped, got, i, j, k;
+    int      ret = NEWFS_ERROR_NONE;
+    unsigned sq_base;
+    boolean  is_fixed;
+    uint8_t* buf;
+
+    for (i = 0, total = 0; i < n; i++) {
+        total += reqs[i].cnt;
+    }
+    if (pthread_mutex_trylock(&newfs_uring.lock) != 0) {
+        pthread_mutex_lock(&newfs_uring.lock);
+        newfs_uring.waits++;
+    }
+    if (newfs_uring.is_broken || newfs_uring_reserve(total) != NEWFS_ERROR_NONE) {
+        pthread_mutex_unlock(&newfs_uring.lock);
+        return newfs_file_dev_submit(fd, reqs, n, sz);
+    }
+
+    for (i = 0, k = 0, nops = 0; ret == NEWFS_ERROR_NONE && i < n; i++) {
+        if (newfs_uring.is_direct && !newfs_file_dev_aligned(fd, reqs[i].bufs, reqs[i].cnt, sz, reqs[i].offset)) {
+            ret = newfs_file_dev_rw(fd, reqs[i].bufs, reqs[i].cnt, sz, reqs[i].offset, reqs[i].is_write);
+            continue;
+        }
+        for (j = 0; j < reqs[i].cnt; j++, k++) {
+            buf = reqs[i].bufs[j];
+            newfs_uring.iovs[k].iov_base = buf;
+            newfs_uring.iovs[k].iov_len  = sz;
+            is_fixed = newfs_uring.reg_base != NULL && buf >= newfs_uring.reg_base &&
+                       buf + sz <= newfs_uring.reg_base + newfs_uring.reg_len;
+            if (j == 0 || is_fixed || op->is_fixed) {
+                op = &newfs_uring.ops[nops++];
+                op->iov      = &newfs_uring.iovs[k];
+                op->iovcnt   = 0;
+                op->len      = 0;
+                op->offset   = reqs[i].offset + (off_t)j * sz;
+                op->is_write = reqs[i].is_write;
+                op->is_fixed = is_fixed;
+                op->is_done  = FALSE;
+            }
+            op->iovcnt++;                             /* 非固定缓冲的相邻块并入同一个READV/WRITEV */
+            op->len += sz;
+        }
+    }
+
+    sq_base = __atomic_load_n(newfs_uring.sq_head, __ATOMIC_ACQUIRE);
+    for (next = 0, inflight = 0, reaped = 0; next < nops || inflight > 0; ) {
+        while (next < nops && inflight < (int)newfs_uring.depth) {
+            newfs_uring_queue(fd, &newfs_uring.ops[next], next);
+            next++;
+            inflight++;
+        }
+        newfs_uring.enters++;
+        if (syscall(__NR_io_uring_enter, newfs_uring.fd,
+                    *newfs_uring.sq_tail - __atomic_load_n(newfs_uring.sq_head, __ATOMIC_ACQUIRE),
+                    1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            NEWFS_DBG("[%s] io_uring_enter: %s\n", __func__, strerror(errno));
+            if (newfs_uring_abort(fd, nops, sq_base, reaped) != NEWFS_ERROR_NONE) {
+                ret = -NEWFS_ERROR_IO;
+            }
+            break;
+        }
+        got       = newfs_uring_reap(fd, &ret);
+        inflight -= got;
+        reaped   += got;
+    }
+    pthread_mutex_unlock(&newfs_uring.lock);
+    return ret;
+}
+static int newfs_uring_pread(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    struct newfs_dev_req req = { .offset = offset, .bufs = bufs, .cnt = cnt, .is_write = FALSE };
+    return newfs_uring_submit(fd, &req, 1, sz);
+}
+static int newfs_uring_pwrite(int fd, uint8_t** bufs, int cnt, int sz, off_t offset) {
+    struct newfs_dev_req req = { .offset = offset, .bufs = bufs, .cnt = cnt, .is_write = TRUE };
+    return newfs_uring_submit(fd, &req, 1, sz);
+}
+static void newfs_uring_close(int fd) {
+    NEWFS_DBG("[%s] sqes %d, enters %d, retries %d, waits %d\n", __func__,
+              newfs_uring.sqes_cnt, newfs_uring.enters, newfs_uring.retries, newfs_uring.waits);
+    newfs_uring_teardown();
+    newfs_file_dev_close(fd);
+}
+#endif
+
+static const struct newfs_dev_ops newfs_dev_backends[] = {
+    {
+        .name    = "ddriver",
+        .open    = newfs_ddriver_open,
+        .pread   = newfs_ddriver_pread,
+        .pwrite  = newfs_ddriver_pwrite,
+        .submit  = newfs_ddriver_submit,
+        .flush   = newfs_ddriver_flush,
+        .size    = newfs_ddriver_size,
+        .io_size = newfs_ddriver_io_size,
+        .close   = newfs_ddriver_close
+    },
+    {
+        .name    = "file",
+        .open    = newfs_file_dev_open,
+        .pread   = newfs_file_dev_pread,
+        .pwrite  = newfs_file_dev_pwrite,
+        .submit  = newfs_file_dev_submit,
+        .flush   = newfs_file_dev_flush,
+        .splice_fd = newfs_file_dev_splice_fd,
+        .size    = newfs_file_dev_size,
+        .io_size = newfs_file_dev_io_size,
+        .close   = newfs_file_dev_close
+    },
+#ifdef NEWFS_HAVE_IO_URING
+    {
+        .name    = "uring",
+        .open    = newfs_uring_open,
+        .pread   = newfs_uring_pread,
+        .pwrite  = newfs_uring_pwrite,
+        .submit  = newfs_uring_submit,
+        .register_mem = newfs_uring_register_mem,
+        .flush   = newfs_file_dev_flush,
+        .splice_fd = newfs_file_dev_splice_fd,
+        .size    = newfs_file_dev_size,
+        .io_size = newfs_file_dev_io_size,
+        .close   = newfs_uring_close
+    },
+#endif
+};
+
+/**
+ * @brief 按名字查找后端
+ *
+ * @param name NULL表示默认的ddriver
+ * @return const struct newfs_dev_ops* 不存在返回NULL
+ */
+const struct newfs_dev_ops* newfs_dev_lookup(const char* name) {
+    int i;
+
+    if (name == NULL) {
+        return &newfs_dev_backends[0];
+    }
+    for (i = 0; i < (int)(sizeof(newfs_dev_backends) / sizeof(newfs_dev_backends[0])); i++) {
+        if (strcmp(newfs_dev_backends[i].name, name) == 0) {
+            return &newfs_dev_backends[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,478 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_JOURNAL()                   (&newfs_super.journal)
+#define NEWFS_JOURNAL_DESC_MAX()          ((int)((NEWFS_BLK_SZ() - sizeof(struct newfs_journal_hdr)) / sizeof(int)))
+#define NEWFS_JOURNAL_NDESC(n)            (((n) + NEWFS_JOURNAL_DESC_MAX() - 1) / NEWFS_JOURNAL_DESC_MAX())
+#define NEWFS_JOURNAL_TXN_BLKS(n)         ((n) + NEWFS_JOURNAL_NDESC(n) + 1)   // 记录n块的事务在日志中占用的块数
+
+/**
+ * 元数据日志（块级重做日志）。日志区在设备末尾，第一块是日志超级块，其后依次存放事务：
+ * | 日志超级块 | 描述块 | 记录块 ... | 描述块 | 记录块 ... | 提交块 | 描述块 | 记录块 ... | 提交块 | ...
+ * 一个描述块至多记录 NEWFS_JOURNAL_DESC_MAX() 块，更大的事务由多个描述块接续，共用一个提交块，
+ * 提交块的校验和覆盖整个事务。
+ * 元数据（超级块、位图、inode表、目录块、间接块）都经过块缓存，提交时把块缓存中全部脏块
+ * 连同描述块和提交块一次seek顺序写入日志，随后这些块标为已记录（LOGGED），不再是脏块。
+ * 检查点把已记录的块写回原位置后重置日志超级块：日志用去超过 NEWFS_JOURNAL_CKPT_PCT% 时由回写线程
+ * 在命名空间写锁之外完成，日志写满时提交前也会先做一次，卸载时做最后一次。
+ * 启用日志时块缓存从不把脏块写回原位置，没有干净块可淘汰时先强制提交；从 newfs_journal_begin 到
+ * 提交完成之间脏元数据只写入了一部分，改为临时扩大块缓存，一次提交总是一个事务。
+ * 修改操作之前由 newfs_wb_throttle 限制脏块数，一次提交不会超过空日志的容量。
+ * 挂载时从日志超级块记录的位置起重放序号连续、校验和正确的事务，遇到第一个不完整的事务停止。
+ * 已记录的块在检查点前若被当作文件数据直接写盘，会经过块缓存进入下一个事务，
+ * 使重放时较新的内容覆盖旧的元数据。
+ */
+
+/**
+ * @brief FNV-1a 校验和
+ *
+ * @param h 初值
+ * @param p
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_journal_csum(uint32_t h, const uint8_t* p, int len) {
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
+/**
+ * @brief 写日志超级块，下一次挂载从日志区第1块、序号为seq的事务开始重放
+ *
+ * @param seq
+ * @return int
+ */
+static int newfs_journal_write_sb(uint32_t seq) {
+    struct newfs_journal*    journal = NEWFS_JOURNAL();
+    struct newfs_journal_sb* jsb     = (struct newfs_journal_sb *)journal->hdrs;
+
+    memset(journal->hdrs, 0, NEWFS_BLK_SZ());
+    jsb->magic = NEWFS_JOURNAL_MAGIC;
+    jsb->seq   = seq;
+    jsb->start = 1;
+    return newfs_dev_write(journal->blkno, &journal->hdrs, 1);
+}
+/**
+ * @brief 读入并校验位于日志区pos处、序号为seq的事务，记录块读入data，原位置记入blknos
+ *
+ * @param pos 相对日志区的位置
+ * @param seq
+ * @param data 输出，cap块
+ * @param blknos 输出，cap项
+ * @param len 输出，事务在日志中占用的块数
+ * @return int 事务中的块数，不完整或不存在返回0
+ */
+static int newfs_journal_read_txn(int pos, uint32_t seq, uint8_t* data, int* blknos, int* len) {
+    struct newfs_journal*     journal = NEWFS_JOURNAL();
+    struct newfs_journal_hdr* hdr     = (struct newfs_journal_hdr *)journal->hdrs;
+    uint8_t* blk   = journal->hdrs;
+    uint32_t csum  = 2166136261u;
+    int      start = pos;
+    int      total = 0;
+    int      cnt, i;
+
+    if (pos + 2 > journal->blks || newfs_dev_read(journal->blkno + pos, &blk, 1) != NEWFS_ERROR_NONE) {
+        return 0;
+    }
+    while (hdr->magic == NEWFS_JOURNAL_MAGIC && hdr->type == NEWFS_JOURNAL_DESC && hdr->seq == seq) {
+        cnt = hdr->cnt;
+        if (cnt <= 0 || cnt > NEWFS_JOURNAL_DESC_MAX() || total + cnt > journal->cap ||
+            pos + cnt + 2 > journal->blks) {
+            return 0;
+        }
+        memcpy(blknos + total, hdr->blknos, cnt * sizeof(int));
+        csum = newfs_journal_csum(csum, journal->hdrs, NEWFS_BLK_SZ());
+        for (i = 0; i < cnt; i++) {
+            journal->vec[i] = data + (size_t)(total + i) * NEWFS_BLK_SZ();
+        }
+        journal->vec[cnt] = journal->hdrs;            /* 紧随其后的下一个描述块或提交块 */
+        if (newfs_dev_read(journal->blkno + pos + 1, journal->vec, cnt + 1) != NEWFS_ERROR_NONE) {
+            return 0;
+        }
+        csum   = newfs_journal_csum(csum, data + (size_t)total * NEWFS_BLK_SZ(), cnt * NEWFS_BLK_SZ());
+        total += cnt;
+        pos   += cnt + 1;
+    }
+    if (total == 0 || hdr->magic != NEWFS_JOURNAL_MAGIC || hdr->type != NEWFS_JOURNAL_COMMIT ||
+        hdr->seq != seq || hdr->cnt != total || hdr->csum != csum) {
+        return 0;
+    }
+    *len = pos + 1 - start;
+    return total;
+}
+/**
+ * @brief 重放日志中已提交的事务，记录块经块缓存写回原位置
+ *
+ * @return int 重放的事务数，出错返回负数
+ */
+static int newfs_journal_replay() {
+    struct newfs_journal*     journal = NEWFS_JOURNAL();
+    struct newfs_journal_sb   jsb;
+    uint8_t* data;
+    int*     blknos;
+    int      pos, cnt, len, i;
+    int      replayed = 0;
+
+    if (newfs_dev_read(journal->blkno, &journal->hdrs, 1) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(&jsb, journal->hdrs, sizeof(struct newfs_journal_sb));
+    if (jsb.magic != NEWFS_JOURNAL_MAGIC) {           /* 日志区从未初始化，序号从当前时间起，旧数据不会被误认为事务 */
+        journal->seq = (uint32_t)time(NULL);
+        return newfs_journal_write_sb(journal->seq);
+    }
+    blknos = (int *)malloc(journal->cap * sizeof(int));
+    if (blknos == NULL ||
+        posix_memalign((void **)&data, NEWFS_IO_SZ(), (size_t)journal->cap * NEWFS_BLK_SZ()) != 0) {
+        free(blknos);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    journal->seq = jsb.seq;
+    pos = jsb.start > 0 ? jsb.start : 1;
+    while ((cnt = newfs_journal_read_txn(pos, journal->seq, data, blknos, &len)) > 0) {
+        for (i = 0; i < cnt; i++) {
+            if (newfs_driver_write(blknos[i] * NEWFS_BLK_SZ(), data + (size_t)i * NEWFS_BLK_SZ(),
+                                   NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+                free(blknos);
+                free(data);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        pos += len;
+        journal->seq++;
+        replayed++;
+    }
+    free(blknos);
+    free(data);
+    if (replayed > 0) {
+        NEWFS_DBG("[%s] replayed %d transactions\n", __func__, replayed);
+        if (newfs_bcache_flush() != NEWFS_ERROR_NONE ||
+            newfs_dev_flush() != NEWFS_ERROR_NONE) {     /* 原位置落盘后才能重置日志 */
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    if (newfs_journal_write_sb(journal->seq) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return replayed;
+}
+/**
+ * @brief 挂载日志，超级块未记录日志区时不启用。重放已提交的事务，日志区未初始化时写入日志超级块
+ *
+ * @param super_d
+ * @return int 重放的事务数，大于0时调用者需重新读取超级块；出错返回负数
+ */
+int newfs_journal_mount(struct newfs_super_d* super_d) {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    int total_blks = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
+    int ret;
+
+    memset(journal, 0, sizeof(struct newfs_journal));
+    if (super_d->journal_blks <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    journal->blkno  = super_d->journal_offset / NEWFS_BLK_SZ();
+    journal->blks   = super_d->journal_blks;
+    journal->cap    = journal->blks - 2;            /* 日志超级块、提交块，每 NEWFS_JOURNAL_DESC_MAX() 块一个描述块 */
+    journal->cap   -= (journal->cap + NEWFS_JOURNAL_DESC_MAX()) / (NEWFS_JOURNAL_DESC_MAX() + 1);
+    journal->ndesc  = NEWFS_JOURNAL_NDESC(journal->cap);
+    journal->head   = 1;
+    journal->logged = (uint8_t *)calloc(NEWFS_ROUND_UP(total_blks, UINT8_BITS) / UINT8_BITS, sizeof(uint8_t));
+    journal->vec    = (uint8_t **)calloc(journal->cap + journal->ndesc + 1, sizeof(uint8_t *));
+    if (journal->logged == NULL || journal->vec == NULL ||
+        posix_memalign((void **)&journal->hdrs, NEWFS_IO_SZ(), (size_t)(journal->ndesc + 1) * NEWFS_BLK_SZ()) != 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    if ((ret = newfs_journal_replay()) < 0) {
+        return ret;
+    }
+    journal->is_enabled = TRUE;
+    return ret;
+}
+/**
+ * @brief 检查点，调用者持有 NEWFS_BCACHE_LOCK。提交后又被修改的块写回日志中的已提交版本，
+ * 其余已记录的块写回缓存中的内容，最后重置日志超级块
+ *
+ * @return int
+ */
+static int newfs_journal_checkpoint_locked() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    struct newfs_buf**    sorted  = newfs_super.bcache.sorted;
+    struct newfs_buf*     buf;
+    uint8_t* scratch = journal->hdrs + NEWFS_BLK_SZ();
+    int      n, k, i;
+
+    if (journal->head == 1) {                         /* 上次检查点以来没有提交过事务 */
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_dev_flush() != NEWFS_ERROR_NONE) {     /* 写回原位置前，日志中的事务须已落盘 */
+        return -NEWFS_ERROR_IO;
+    }
+    n = newfs_bcache_collect(NEWFS_FLAG_BUF_LOGGED);
+    for (i = 0, k = 0; i < n; i++) {
+        buf = sorted[i];
+        if (buf->flag & NEWFS_FLAG_BUF_DIRTY) {      /* 缓存中是未提交的内容，原位置只能写入已提交的版本 */
+            if (newfs_dev_read(journal->blkno + buf->jblk, &scratch, 1) != NEWFS_ERROR_NONE ||
+                newfs_dev_write(buf->blkno, &scratch, 1) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+            buf->flag &= ~NEWFS_FLAG_BUF_LOGGED;
+        }
+        else {
+            sorted[k++] = buf;
+        }
+    }
+    if (newfs_bcache_write_runs(sorted, k) != NEWFS_ERROR_NONE ||
+        newfs_dev_flush() != NEWFS_ERROR_NONE ||           /* 原位置落盘后才能丢弃日志 */
+        newfs_journal_write_sb(journal->seq) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    memset(journal->logged, 0, NEWFS_ROUND_UP((NEWFS_DISK_SZ() / NEWFS_BLK_SZ()), UINT8_BITS) / UINT8_BITS);
+    journal->head = 1;
+    journal->checkpoints++;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 检查点：把已记录的块写回原位置，日志重新从头使用。卸载时调用
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+    int ret;
+
+    if (!newfs_super.journal.is_enabled) {
+        return NEWFS_ERROR_NONE;
+    }
+    NEWFS_BCACHE_LOCK();
+    ret = newfs_journal_checkpoint_locked();
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 日志用去超过 NEWFS_JOURNAL_CKPT_PCT% 时做检查点，回写线程放开命名空间写锁后调用。
+ * 提交同样在 NEWFS_BCACHE_LOCK 下进行，检查点期间不会有新事务写入日志
+ *
+ * @return int
+ */
+int newfs_journal_reclaim() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    int ret = NEWFS_ERROR_NONE;
+
+    if (!journal->is_enabled) {
+        return NEWFS_ERROR_NONE;
+    }
+    NEWFS_BCACHE_LOCK();
+    if (journal->head * 100 >= journal->blks * NEWFS_JOURNAL_CKPT_PCT) {
+        ret = newfs_journal_checkpoint_locked();
+    }
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 把sorted中前n个脏块作为一个事务顺序写入日志，调用者持有 NEWFS_BCACHE_LOCK。
+ * 每 NEWFS_JOURNAL_DESC_MAX() 块前放一个描述块，最后是覆盖全部描述块和记录块的提交块
+ *
+ * @param n 块数，不超过 journal->cap
+ * @return int
+ */
+static int newfs_journal_write_txn(int n) {
+    struct newfs_journal*     journal = NEWFS_JOURNAL();
+    struct newfs_buf**        sorted  = newfs_super.bcache.sorted;
+    struct newfs_journal_hdr* desc;
+    struct newfs_journal_hdr* commit;
+    uint32_t csum  = 2166136261u;
+    int      ndesc = NEWFS_JOURNAL_NDESC(n);
+    int      v     = 0;
+    int      i, j, k, cnt;
+
+    memset(journal->hdrs, 0, (size_t)(ndesc + 1) * NEWFS_BLK_SZ());
+    for (i = 0, k = 0; i < n; i += cnt, k++) {
+        cnt  = n - i < NEWFS_JOURNAL_DESC_MAX() ? n - i : NEWFS_JOURNAL_DESC_MAX();
+        desc = (struct newfs_journal_hdr *)(journal->hdrs + (size_t)k * NEWFS_BLK_SZ());
+        desc->magic = NEWFS_JOURNAL_MAGIC;
+        desc->type  = NEWFS_JOURNAL_DESC;
+        desc->seq   = journal->seq;
+        desc->cnt   = cnt;
+        journal->vec[v++] = (uint8_t *)desc;
+        for (j = 0; j < cnt; j++) {
+            desc->blknos[j]   = sorted[i + j]->blkno;
+            journal->vec[v++] = sorted[i + j]->data;
+        }
+        csum = newfs_journal_csum(csum, (uint8_t *)desc, NEWFS_BLK_SZ());
+        for (j = 0; j < cnt; j++) {
+            csum = newfs_journal_csum(csum, sorted[i + j]->data, NEWFS_BLK_SZ());
+        }
+    }
+    commit = (struct newfs_journal_hdr *)(journal->hdrs + (size_t)ndesc * NEWFS_BLK_SZ());
+    commit->magic = NEWFS_JOURNAL_MAGIC;
+    commit->type  = NEWFS_JOURNAL_COMMIT;
+    commit->seq   = journal->seq;
+    commit->cnt   = n;
+    commit->csum  = csum;
+    journal->vec[v++] = (uint8_t *)commit;
+
+    if (newfs_dev_write(journal->blkno + journal->head, journal->vec, v) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < n; i++) {
+        sorted[i]->jblk  = journal->head + i + i / NEWFS_JOURNAL_DESC_MAX() + 1;
+        sorted[i]->flag  = (sorted[i]->flag & ~NEWFS_FLAG_BUF_DIRTY) | NEWFS_FLAG_BUF_LOGGED;
+        journal->logged[sorted[i]->blkno / UINT8_BITS] |= (uint8_t)(1 << (sorted[i]->blkno % UINT8_BITS));
+    }
+    journal->head += v;
+    journal->commits++;
+    journal->logged_blks += n;
+    __atomic_store_n(&journal->seq, journal->seq + 1, __ATOMIC_RELEASE);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把sorted前n个块中的位图块稳定地移到最前面
+ *
+ * @param n
+ */
+static void newfs_journal_bitmaps_first(int n) {
+    struct newfs_buf** sorted = newfs_super.bcache.sorted;
+    struct newfs_buf*  buf;
+    int i, j, k;
+
+    for (i = 0, k = 0; i < n; i++) {
+        if (newfs_bitmap_owns(&newfs_super.bm_inode, sorted[i]->blkno) ||
+            newfs_bitmap_owns(&newfs_super.bm_data, sorted[i]->blkno)) {
+            buf = sorted[i];
+            for (j = i; j > k; j--) {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[k++] = buf;
+        }
+    }
+}
+/**
+ * @brief 提交块缓存中的全部脏块，调用者持有 NEWFS_BCACHE_LOCK，返回前不等待落盘。
+ * 全部脏块作为一个事务写入日志，日志剩余空间不足时先做检查点。
+ * 脏块多于空日志的容量时（newfs_wb_throttle 使之不会发生）只能按容量拆成依次提交的事务，
+ * 位图块排在最前，只重放了前面的事务时新分配的inode和块已标为占用，不会被重复分配
+ *
+ * @return int
+ */
+int newfs_journal_commit_locked() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    int n, ret;
+
+    while ((n = newfs_bcache_collect(NEWFS_FLAG_BUF_DIRTY)) > 0) {
+        if (n > journal->cap) {
+            NEWFS_DBG("[%s] %d dirty blocks exceed the journal, splitting the commit\n", __func__, n);
+            newfs_journal_bitmaps_first(n);
+            n = journal->cap;
+        }
+        if (journal->head + NEWFS_JOURNAL_TXN_BLKS(n) > journal->blks) {  /* 日志写满，先做检查点 */
+            if ((ret = newfs_journal_checkpoint_locked()) != NEWFS_ERROR_NONE) {
+                return ret;
+            }
+            continue;                                 /* 检查点复用了sorted，重新收集 */
+        }
+        if ((ret = newfs_journal_write_txn(n)) != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 开始一次完整的提交，随后把全部脏元数据写入块缓存并调用 newfs_journal_commit，调用者持有命名空间写锁。
+ * 其间块缓存被脏块占满时临时增加缓冲块，只写入了一部分的元数据不会被强制提交。
+ * 写入失败时保持打开，直到下一次完整的提交成功
+ *
+ */
+void newfs_journal_begin() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+
+    if (!journal->is_enabled) {
+        return;
+    }
+    NEWFS_BCACHE_LOCK();
+    journal->is_open = TRUE;
+    NEWFS_BCACHE_UNLOCK();
+}
+/**
+ * @brief 提交：块缓存中的全部脏块写入日志并落盘，调用者持有命名空间写锁。
+ * 没有脏块时同样落盘，此前直接写设备的文件数据也由此持久化。
+ * 落盘后才放开 NEWFS_BCACHE_LOCK：已记录的块随即可被淘汰并写回原位置，此前事务须已在稳定存储上。
+ * 提交完成后释放提交期间临时增加的缓冲块
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    int ret;
+
+    NEWFS_BCACHE_LOCK();
+    ret = newfs_journal_commit_locked();
+    if (ret == NEWFS_ERROR_NONE) {
+        ret = newfs_dev_flush();                      /* 提交块带有整个事务的校验和，一次落盘即可 */
+    }
+    if (ret == NEWFS_ERROR_NONE) {
+        NEWFS_JOURNAL()->is_open = FALSE;
+        ret = newfs_bcache_shrink();
+    }
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 块是否出现在尚未做检查点的事务中，调用者持有 NEWFS_BCACHE_LOCK
+ *
+ * @param blkno
+ * @return boolean
+ */
+boolean newfs_journal_is_logged(int blkno) {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    return journal->is_enabled && (journal->logged[blkno / UINT8_BITS] & (1 << (blkno % UINT8_BITS)));
+}
+/**
+ * @brief 一次完整的提交（全部脏元数据写入块缓存后提交并落盘）已经完成，调用者持有命名空间写锁
+ *
+ */
+void newfs_journal_synced() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    __atomic_store_n(&journal->syncs, journal->syncs + 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief fsync：提交此前的全部修改。等待写锁期间若其他线程已完成一次完整的提交，
+ * 本次调用之前的修改已随之落盘，直接返回（组提交）。淘汰缓冲块时的强制提交只含块缓存中的脏块，
+ * 不含尚在内存中的inode，不算作完整的提交。没有日志时整体刷写
+ *
+ * @return int
+ */
+int newfs_journal_sync() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+    uint32_t target = __atomic_load_n(&journal->syncs, __ATOMIC_ACQUIRE);
+    int      ret;
+
+    NEWFS_WRLOCK();
+    if (journal->is_enabled && journal->syncs != target) {
+        journal->joins++;
+        ret = NEWFS_ERROR_NONE;
+    }
+    else {
+        ret = newfs_commit();
+    }
+    NEWFS_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 卸载日志，调用前需先提交并做完检查点
+ *
+ */
+void newfs_journal_umount() {
+    struct newfs_journal* journal = NEWFS_JOURNAL();
+
+    if (journal->is_enabled) {
+        NEWFS_DBG("[%s] commits %d, logged blocks %d, checkpoints %d, joined fsyncs %d\n", __func__,
+                  journal->commits, journal->logged_blks, journal->checkpoints, journal->joins);
+    }
+    free(journal->logged);
+    free(journal->hdrs);
+    free(journal->vec);
+    memset(journal, 0, sizeof(struct newfs_journal));
+}
@@ -0,0 +1,119 @@
+#include "../include/newfs.h"
+
+/**
+ * 磁盘布局由设备大小和inode比例（每多少字节设备空间配一个inode）推算，超级块之后是若干块组：
+ * | Super | Inode Map | Data Map | Inode Table | Data | Inode Map | Data Map | Inode Table | Data | ...
+ * 每个块组的数据位图占一块，管理 sz_blk*8 个数据块；inode位图也占一块，inode数按inode比例推算。
+ * 设备放得下一个完整块组时只有一个块组，inode数按整个设备推算，与未分组时的布局相同。
+ * 最后一个块组的数据区可以不满。设备最后的若干块留作元数据日志，见 newfs_journal.c。
+ * 挂载时发现未格式化的设备与mkfs.newfs使用同一套计算，因此两者得到相同的布局。
+ */
+
+/**
+ * @brief 按设备大小推算布局，填写超级块
+ *
+ * @param sz_disk 设备字节数
+ * @param sz_blk 块大小
+ * @param inode_ratio 每个inode对应的设备字节数
+ * @param journal_blks 日志区块数，NEWFS_JOURNAL_AUTO按设备大小推算，0表示不要日志
+ * @param super_d 输出
+ * @return int 设备太小放不下元数据时返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_layout_calc(int sz_disk, int sz_blk, int inode_ratio, int journal_blks,
+                      struct newfs_super_d* super_d) {
+    int bits_per_blk   = sz_blk * UINT8_BITS;
+    int inodes_per_blk = sz_blk / NEWFS_INODE_SZ();
+    int total_blks     = sz_disk / sz_blk;
+    int ino_per_group, itable_blks, group_blks;
+    int groups, data_num, tail, rest;
+
+    if (journal_blks == NEWFS_JOURNAL_AUTO) {
+        journal_blks = total_blks / 32;
+        journal_blks = journal_blks < NEWFS_JOURNAL_MIN_BLKS ? NEWFS_JOURNAL_MIN_BLKS : journal_blks;
+        journal_blks = journal_blks > NEWFS_JOURNAL_MAX_BLKS ? NEWFS_JOURNAL_MAX_BLKS : journal_blks;
+    }
+    if (inode_ratio < sz_blk || journal_blks < 0 || (journal_blks > 0 && journal_blks < 4)) {
+        return -NEWFS_ERROR_INVAL;                    /* 日志区至少放得下日志超级块和一个单块事务 */
+    }
+    rest = total_blks - NEWFS_SUPER_BLKS - journal_blks;
+    /* 先按单个块组推算，放不下时改为每组 bits_per_blk 个数据块，inode数按一个完整块组推算 */
+    ino_per_group = NEWFS_ROUND_UP((sz_disk / inode_ratio), NEWFS_GROUP_INO_ALIGN);
+    if (ino_per_group > bits_per_blk) {
+        ino_per_group = bits_per_blk;
+    }
+    itable_blks   = ino_per_group / inodes_per_blk;
+    if (rest <= 2 + itable_blks + bits_per_blk) {
+        groups     = 1;
+        data_num   = rest - 2 - itable_blks;
+        group_blks = rest;
+    }
+    else {
+        ino_per_group = NEWFS_ROUND_UP(((int)((long)bits_per_blk * sz_blk / inode_ratio)), NEWFS_GROUP_INO_ALIGN);
+        if (ino_per_group > bits_per_blk) {
+            ino_per_group = bits_per_blk;
+        }
+        itable_blks = ino_per_group / inodes_per_blk;
+        group_blks  = 2 + itable_blks + bits_per_blk;
+        groups      = rest / group_blks;
+        data_num    = groups * bits_per_blk;
+        tail        = rest % group_blks - 2 - itable_blks;
+        if (tail > 0) {                               /* 剩余的块组成一个数据区不满的块组 */
+            groups++;
+            data_num += tail;
+        }
+    }
+    if (ino_per_group == 0 || data_num <= 0) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    memset(super_d, 0, sizeof(struct newfs_super_d));
+    super_d->magic_num        = NEWFS_MAGIC_NUM;
+    super_d->sz_usage         = 0;
+    super_d->max_ino          = groups * ino_per_group;
+    super_d->max_data         = data_num;
+    super_d->groups           = groups;
+    super_d->ino_per_group    = ino_per_group;
+    super_d->data_per_group   = groups == 1 ? data_num : bits_per_blk;
+    super_d->group_blks       = group_blks;
+    super_d->map_inode_blks   = 1;
+    super_d->map_data_blks    = 1;
+    super_d->map_inode_offset = NEWFS_SUPER_OFS + NEWFS_SUPER_BLKS * sz_blk;
+    super_d->map_data_offset  = super_d->map_inode_offset + sz_blk;
+    super_d->inode_offset     = super_d->map_data_offset + sz_blk;
+    super_d->data_offset      = super_d->inode_offset + itable_blks * sz_blk;
+    super_d->journal_blks     = journal_blks;
+    super_d->journal_offset   = (total_blks - journal_blks) * sz_blk;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 按超级块写出tests/checkbm使用的布局文件
+ *
+ * @param path 输出路径
+ * @param super_d
+ * @param sz_blk
+ * @return int
+ */
+int newfs_layout_write(const char* path, struct newfs_super_d* super_d, int sz_blk) {
+    FILE* fp = fopen(path, "w");
+
+    if (fp == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    fprintf(fp, "# Layout File\n");
+    fprintf(fp, "#\n");
+    fprintf(fp, "# 由 mkfs.newfs 按设备大小生成: %d 个inode, %d 个数据块\n",
+            super_d->max_ino, super_d->max_data);
+    if (super_d->groups > 1) {                        /* 布局行只描述块组0，其余块组每隔group_blks块重复 */
+        fprintf(fp, "# 共 %d 个块组，每组 %d 块，下面只列出块组0\n", super_d->groups, super_d->group_blks);
+    }
+    if (super_d->journal_blks > 0) {                  /* 日志区在设备末尾，包含在DATA(*)中 */
+        fprintf(fp, "# 设备最后 %d 块为元数据日志\n", super_d->journal_blks);
+    }
+    fprintf(fp, "\n");
+    fprintf(fp, "| BSIZE = %d B |\n", sz_blk);
+    fprintf(fp, "| Super(%d) | Inode Map(%d) | DATA MAP(%d) | Inode Table(%d) | DATA(*) |",  /* checkbm要求布局行后没有换行 */
+            NEWFS_SUPER_BLKS, super_d->map_inode_blks, super_d->map_data_blks,
+            (super_d->data_offset - super_d->inode_offset) / sz_blk);
+    fclose(fp);
+    return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,632 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+extern struct custom_options   newfs_options;
+
+#define NEWFS_LL_TIMEOUT                  1.0       // 内核缓存属性和目录项的时间（秒）
+#define NEWFS_LL_INO(pdentry)             ((fuse_ino_t)(pdentry)->ino + 1)   // newfs的ino从0开始，FUSE根目录为1
+
+/**
+ * 低层接口：内核以inode号而非路径发起请求，通过 newfs_super.ino_dentry 直接找到对应的dentry，
+ * lookup每次只解析一层，深层路径不再在每个操作中从根逐层查找。
+ * 加锁方式与 newfs.c 中的高层接口相同。
+ */
+static struct fuse_session* newfs_ll_session;
+
+/**
+ * @brief FUSE inode号 -> dentry，调用者持有命名空间锁。延迟挂载时根目录的inode在此首次读入
+ *
+ * @param ino FUSE inode号
+ * @return struct newfs_dentry* 不存在返回NULL
+ */
+static struct newfs_dentry* newfs_ll_dentry(fuse_ino_t ino) {
+	struct newfs_dentry* dentry;
+
+	if (ino < FUSE_ROOT_ID || ino > (fuse_ino_t)newfs_super.max_ino) {
+		return NULL;
+	}
+	dentry = newfs_super.ino_dentry[ino - 1];
+	if (dentry != NULL && newfs_dentry_inode(dentry) == NULL) {
+		return NULL;
+	}
+	return dentry;
+}
+/**
+ * @brief 取目录parent下名为name的目录项并读入其inode，调用者持有命名空间锁
+ *
+ * @param parent 父目录的FUSE inode号
+ * @param name
+ * @param err 输出，失败时的错误码（正数）
+ * @return struct newfs_dentry* 失败返回NULL
+ */
+static struct newfs_dentry* newfs_ll_child(fuse_ino_t parent, const char* name, int* err) {
+	struct newfs_dentry* dir = newfs_ll_dentry(parent);
+	struct newfs_dentry* child;
+
+	if (dir == NULL) {
+		*err = NEWFS_ERROR_NOTFOUND;
+		return NULL;
+	}
+	if (!NEWFS_IS_DIR(dir->inode)) {
+		*err = NEWFS_ERROR_NOTDIR;
+		return NULL;
+	}
+	child = newfs_index_find(dir->inode, name);
+	if (child == NULL || newfs_dentry_inode(child) == NULL) {
+		*err = NEWFS_ERROR_NOTFOUND;
+		return NULL;
+	}
+	return child;
+}
+/**
+ * @brief 填充lookup/mknod/mkdir的回复，内核每收到一次entry，该inode号的lookup计数加1，
+ * 直到 newfs_ll_forget 减为0之前这个号不会分给新文件。调用者持有命名空间锁
+ *
+ * @param dentry
+ * @param e
+ */
+static void newfs_ll_fill_entry(struct newfs_dentry* dentry, struct fuse_entry_param* e) {
+	if (newfs_super.nlookup != NULL) {
+		__atomic_add_fetch(&newfs_super.nlookup[dentry->ino], 1, __ATOMIC_RELEASE);
+	}
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	e->ino           = NEWFS_LL_INO(dentry);
+	e->attr_timeout  = NEWFS_LL_TIMEOUT;
+	e->entry_timeout = NEWFS_LL_TIMEOUT;
+	newfs_fill_stat(dentry, &e->attr);
+}
+/**
+ * @brief 挂载文件系统
+ *
+ * @param userdata 可忽略
+ * @param conn_info 可忽略
+ */
+static void newfs_ll_init(void* userdata, struct fuse_conn_info* conn_info) {
+	(void)userdata;
+	(void)conn_info;
+	if (newfs_mount(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] mount error\n", __func__);
+		fuse_session_exit(newfs_ll_session);
+		return;
+	}
+	if (newfs_wb_start(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] writeback thread error\n", __func__);
+	}
+	if (newfs_ra_start(newfs_options) != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] readahead thread error\n", __func__);
+	}
+}
+/**
+ * @brief 卸载文件系统
+ *
+ * @param userdata 可忽略
+ */
+static void newfs_ll_destroy(void* userdata) {
+	(void)userdata;
+	newfs_ra_stop();
+	newfs_wb_stop();
+	NEWFS_WRLOCK();
+	if (newfs_umount() != NEWFS_ERROR_NONE) {
+		NEWFS_DBG("[%s] umount error\n", __func__);
+	}
+	NEWFS_UNLOCK();
+}
+/**
+ * @brief 在目录parent中查找name，内核据此缓存 name -> inode号
+ *
+ * @param req
+ * @param parent 父目录的FUSE inode号
+ * @param name
+ */
+static void newfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	struct fuse_entry_param e;
+	struct newfs_dentry* dentry;
+	int		err;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_child(parent, name, &err);
+	if (dentry == NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, err);
+		return;
+	}
+	newfs_ll_fill_entry(dentry, &e);
+	NEWFS_UNLOCK();
+	fuse_reply_entry(req, &e);
+}
+/**
+ * @brief 内核释放inode号的nlookup次引用。dentry常驻内存，只需减少计数：
+ * 文件已删除时计数减为0后它的inode号才能重新分配，见 newfs_alloc_ino
+ *
+ * @param req
+ * @param ino
+ * @param nlookup
+ */
+static void newfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+	if (newfs_super.nlookup != NULL && ino >= FUSE_ROOT_ID && ino <= (fuse_ino_t)newfs_super.max_ino) {
+		__atomic_sub_fetch(&newfs_super.nlookup[ino - 1], nlookup, __ATOMIC_RELEASE);
+	}
+	fuse_reply_none(req);
+}
+/**
+ * @brief 获取文件属性
+ *
+ * @param req
+ * @param ino
+ * @param fi 可忽略
+ */
+static void newfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+	struct stat	st;
+	(void)fi;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	newfs_fill_stat(dentry, &st);
+	NEWFS_UNLOCK();
+	fuse_reply_attr(req, &st, NEWFS_LL_TIMEOUT);
+}
+/**
+ * @brief 修改文件属性，只支持改变大小，其余属性与高层接口一样忽略
+ *
+ * @param req
+ * @param ino
+ * @param attr 新属性
+ * @param to_set FUSE_SET_ATTR_*
+ * @param fi 可忽略
+ */
+static void newfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set,
+							 struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+	struct stat	st;
+	int		ret = NEWFS_ERROR_NONE;
+	(void)fi;
+
+	newfs_wb_throttle();									/* 脏块过多时先刷写，不持有命名空间锁 */
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+		return;
+	}
+	if (to_set & FUSE_SET_ATTR_SIZE) {
+		if (NEWFS_IS_DIR(dentry->inode)) {
+			ret = -NEWFS_ERROR_ISDIR;
+		}
+		else {
+			NEWFS_INODE_WRLOCK(dentry->inode);
+			ret = newfs_file_truncate(dentry->inode, attr->st_size);
+			NEWFS_INODE_UNLOCK(dentry->inode);
+		}
+	}
+	if (ret == NEWFS_ERROR_NONE) {
+		newfs_fill_stat(dentry, &st);
+	}
+	NEWFS_UNLOCK();
+	if (ret != NEWFS_ERROR_NONE) {
+		fuse_reply_err(req, -ret);
+		return;
+	}
+	fuse_reply_attr(req, &st, NEWFS_LL_TIMEOUT);
+}
+/**
+ * @brief 创建文件或目录，mknod与mkdir共用
+ *
+ * @param req
+ * @param parent 父目录的FUSE inode号
+ * @param name
+ * @param ftype
+ */
+static void newfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, FILE_TYPE ftype) {
+	struct fuse_entry_param e;
+	struct newfs_dentry* dir;
+	struct newfs_dentry* dentry;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	dir = newfs_ll_dentry(parent);
+	if (dir == NULL || !NEWFS_IS_DIR(dir->inode)) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, dir == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOTDIR);
+		return;
+	}
+	if (newfs_index_find(dir->inode, name) != NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_EXISTS);
+		return;
+	}
+	dentry = newfs_create_dentry(dir, name, ftype);
+	if (dentry == NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return;
+	}
+	newfs_ll_fill_entry(dentry, &e);
+	NEWFS_UNLOCK();
+	fuse_reply_entry(req, &e);
+}
+/**
+ * @brief 创建文件
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode
+ * @param rdev 可忽略
+ */
+static void newfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, dev_t rdev) {
+	(void)rdev;
+	newfs_ll_create(req, parent, name, S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE);
+}
+/**
+ * @brief 创建目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param mode 可忽略
+ */
+static void newfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+	(void)mode;
+	newfs_ll_create(req, parent, name, NEWFS_DIR);
+}
+/**
+ * @brief 删除文件或空目录，unlink与rmdir共用
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param is_dir 是否为rmdir
+ */
+static void newfs_ll_remove(fuse_req_t req, fuse_ino_t parent, const char* name, boolean is_dir) {
+	struct newfs_dentry* dentry;
+	int		err;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	dentry = newfs_ll_child(parent, name, &err);
+	if (dentry == NULL) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, err);
+		return;
+	}
+	if (NEWFS_IS_DIR(dentry->inode) != is_dir) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, is_dir ? NEWFS_ERROR_NOTDIR : NEWFS_ERROR_ISDIR);
+		return;
+	}
+	err = -newfs_remove_dentry(dentry);					/* 非空目录返回 ENOTEMPTY */
+	NEWFS_UNLOCK();
+	fuse_reply_err(req, err);
+}
+/**
+ * @brief 删除文件
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void newfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	newfs_ll_remove(req, parent, name, FALSE);
+}
+/**
+ * @brief 删除目录
+ *
+ * @param req
+ * @param parent
+ * @param name
+ */
+static void newfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+	newfs_ll_remove(req, parent, name, TRUE);
+}
+/**
+ * @brief 重命名，语义与 newfs_rename 相同：同类型的目标被替换，不能移动到自己的子目录下
+ *
+ * @param req
+ * @param parent 原父目录
+ * @param name 原名字
+ * @param newparent 新父目录
+ * @param newname 新名字
+ */
+static void newfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+							fuse_ino_t newparent, const char* newname) {
+	struct newfs_dentry* from_dentry;
+	struct newfs_dentry* to_parent;
+	struct newfs_dentry* to_dentry;
+	struct newfs_dentry* cursor;
+	int		err;
+
+	newfs_wb_throttle();
+	NEWFS_WRLOCK();
+	from_dentry = newfs_ll_child(parent, name, &err);
+	to_parent   = newfs_ll_dentry(newparent);
+	if (from_dentry == NULL || to_parent == NULL || !NEWFS_IS_DIR(to_parent->inode)) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, from_dentry == NULL ? err :
+							to_parent == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOTDIR);
+		return;
+	}
+	for (cursor = to_parent; cursor != NULL; cursor = cursor->parent) {
+		if (cursor == from_dentry) {						/* 不能移动到自己的子目录下 */
+			NEWFS_UNLOCK();
+			fuse_reply_err(req, NEWFS_ERROR_INVAL);
+			return;
+		}
+	}
+
+	to_dentry = newfs_ll_child(newparent, newname, &err);
+	err = NEWFS_ERROR_NONE;
+	if (to_dentry == from_dentry) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, NEWFS_ERROR_NONE);
+		return;
+	}
+	if (to_dentry != NULL &&							/* 目标已存在：同类型时替换，移动成功后才删除 */
+		NEWFS_IS_DIR(to_dentry->inode) != NEWFS_IS_DIR(from_dentry->inode)) {
+		err = NEWFS_IS_DIR(from_dentry->inode) ? NEWFS_ERROR_NOTDIR : NEWFS_ERROR_ISDIR;
+	}
+	if (err == NEWFS_ERROR_NONE) {
+		err = -newfs_move_dentry(from_dentry, to_parent, newname, to_dentry);
+	}
+	NEWFS_UNLOCK();
+	fuse_reply_err(req, err);
+}
+/**
+ * @brief 读文件，磁盘上内容最新的整块由FUSE直接从设备文件splice给内核，见 newfs_file_read_buf
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi fh为预读状态
+ */
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+						  struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+	struct fuse_bufvec* vec;
+	int		ret;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL || NEWFS_IS_DIR(dentry->inode)) {
+		ret = dentry == NULL ? -NEWFS_ERROR_NOTFOUND : -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		NEWFS_INODE_RDLOCK(dentry->inode);
+		newfs_ra_update(dentry->inode, NEWFS_RA_STATE(fi), off, size);
+		ret = newfs_file_read_buf(dentry->inode, &vec, size, off);
+		if (ret >= 0) {								/* 持锁回复，splice读出的块不会被改写或重新分配 */
+			fuse_reply_data(req, vec, FUSE_BUF_SPLICE_MOVE);
+			newfs_free_bufvec(vec);
+		}
+		NEWFS_INODE_UNLOCK(dentry->inode);
+	}
+	NEWFS_UNLOCK();
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+	}
+}
+/**
+ * @brief 打开文件，见 newfs_open
+ *
+ * @param req
+ * @param ino 不使用
+ * @param fi
+ */
+static void newfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	(void)ino;
+	newfs_open(NULL, fi);
+	fuse_reply_open(req, fi);
+}
+/**
+ * @brief 关闭文件，见 newfs_release
+ *
+ * @param req
+ * @param ino 不使用
+ * @param fi
+ */
+static void newfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	(void)ino;
+	newfs_release(NULL, fi);
+	fuse_reply_err(req, 0);
+}
+/**
+ * @brief 写文件
+ *
+ * @param req
+ * @param ino
+ * @param buf
+ * @param size
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t off,
+						   struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+	int		ret;
+	(void)fi;
+
+	newfs_wb_throttle();
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL || NEWFS_IS_DIR(dentry->inode)) {
+		ret = dentry == NULL ? -NEWFS_ERROR_NOTFOUND : -NEWFS_ERROR_ISDIR;
+	}
+	else {
+		NEWFS_INODE_WRLOCK(dentry->inode);
+		ret = newfs_file_write(dentry->inode, (const uint8_t *)buf, size, off);
+		NEWFS_INODE_UNLOCK(dentry->inode);
+	}
+	NEWFS_UNLOCK();
+	if (ret < 0) {
+		fuse_reply_err(req, -ret);
+	}
+	else {
+		fuse_reply_write(req, ret);
+	}
+}
+/**
+ * @brief 同步文件或目录，见 newfs_fsync
+ *
+ * @param req
+ * @param ino 不使用
+ * @param datasync 不区分
+ * @param fi 可忽略
+ */
+static void newfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+	int		ret = newfs_journal_sync();
+	(void)ino;
+	(void)datasync;
+	(void)fi;
+	fuse_reply_err(req, -ret);
+}
+/**
+ * @brief 打开目录，计入打开的目录句柄，见 newfs_opendir
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL || !NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		fuse_reply_err(req, dentry == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOTDIR);
+		return;
+	}
+	__atomic_add_fetch(&newfs_super.dir_opens, 1, __ATOMIC_RELEASE);
+	NEWFS_UNLOCK();
+	fuse_reply_open(req, fi);
+}
+/**
+ * @brief 关闭目录
+ *
+ * @param req
+ * @param ino 不使用
+ * @param fi 可忽略
+ */
+static void newfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+	(void)ino;
+	newfs_releasedir(NULL, fi);
+	fuse_reply_err(req, 0);
+}
+/**
+ * @brief 遍历目录项，一次尽量填满size字节，off为下一个槽位，删除留下的空槽跳过
+ *
+ * @param req
+ * @param ino
+ * @param size
+ * @param off
+ * @param fi 可忽略
+ */
+static void newfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+							 struct fuse_file_info* fi) {
+	struct newfs_dentry* dentry;
+	struct newfs_dentry** slots;
+	struct stat	st;
+	char*	buf;
+	size_t	pos = 0;
+	size_t	len;
+	int		cnt;
+	(void)fi;
+
+	buf = (char *)malloc(size);
+	if (buf == NULL) {
+		fuse_reply_err(req, NEWFS_ERROR_NOSPACE);
+		return;
+	}
+	NEWFS_RDLOCK();
+	dentry = newfs_ll_dentry(ino);
+	if (dentry == NULL || !NEWFS_IS_DIR(dentry->inode)) {
+		NEWFS_UNLOCK();
+		free(buf);
+		fuse_reply_err(req, dentry == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOTDIR);
+		return;
+	}
+	cnt = newfs_dir_slots(dentry->inode, &slots);
+	memset(&st, 0, sizeof(struct stat));
+	for (; off < cnt; off++) {								/* 偏移即下一个槽位 */
+		if (slots[off] == NULL) {
+			continue;
+		}
+		st.st_ino  = NEWFS_LL_INO(slots[off]);
+		st.st_mode = slots[off]->ftype == NEWFS_DIR ? S_IFDIR : S_IFREG;
+		len = fuse_add_direntry(req, buf + pos, size - pos, slots[off]->name, &st, off + 1);
+		if (len > size - pos) {							/* 放不下，下次从这一项继续 */
+			break;
+		}
+		pos += len;
+	}
+	NEWFS_UNLOCK();
+	fuse_reply_buf(req, buf, pos);
+	free(buf);
+}
+/******************************************************************************
+* SECTION: FUSE低层操作定义
+*******************************************************************************/
+static const struct fuse_lowlevel_ops newfs_ll_ops = {
+	.init = newfs_ll_init,
+	.destroy = newfs_ll_destroy,
+	.lookup = newfs_ll_lookup,
+	.forget = newfs_ll_forget,
+	.getattr = newfs_ll_getattr,
+	.setattr = newfs_ll_setattr,				 /* 改变文件大小 */
+	.mknod = newfs_ll_mknod,
+	.mkdir = newfs_ll_mkdir,
+	.unlink = newfs_ll_unlink,
+	.rmdir = newfs_ll_rmdir,
+	.rename = newfs_ll_rename,
+	.read = newfs_ll_read,
+	.write = newfs_ll_write,
+	.readdir = newfs_ll_readdir,
+	.fsync = newfs_ll_fsync,
+	.fsyncdir = newfs_ll_fsync,
+
+	.open = newfs_ll_open,
+	.release = newfs_ll_release,
+	.opendir = newfs_ll_opendir,
+	.releasedir = newfs_ll_releasedir
+};
+/**
+ * @brief 以低层接口运行，--lowlevel 时代替 fuse_main
+ *
+ * @param args 已去掉newfs自己的参数
+ * @return int
+ */
+int newfs_ll_main(struct fuse_args* args) {
+	struct fuse_chan* ch;
+	char*	mountpoint;
+	int		multithreaded, foreground;
+	int		ret = -1;
+
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) {
+		return 1;
+	}
+	ch = fuse_mount(mountpoint, args);
+	if (ch != NULL) {
+		newfs_ll_session = fuse_lowlevel_new(args, &newfs_ll_ops, sizeof(newfs_ll_ops), NULL);
+		if (newfs_ll_session != NULL) {
+			if (fuse_set_signal_handlers(newfs_ll_session) != -1) {
+				fuse_session_add_chan(newfs_ll_session, ch);
+				fuse_daemonize(foreground);
+				ret = multithreaded ? fuse_session_loop_mt(newfs_ll_session)
+									: fuse_session_loop(newfs_ll_session);
+				fuse_remove_signal_handlers(newfs_ll_session);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(newfs_ll_session);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,241 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_RA()                        (&newfs_super.ra)
+
+/**
+ * 顺序预读。每个打开的文件在fi->fh中记录上一次读到哪里：本次读紧接上一次时视为顺序读，
+ * 预读窗口从 NEWFS_RA_MIN_BLKS 块起每次翻倍，直到 --ra_kb 的上限。
+ * 本次读的首尾块不在缓存中说明预读没有跟上，在读者中同步读入一个窗口（本次读因此合并为一次大块读）；
+ * 读到已预读范围的后半段时交给预读线程异步读入下一个窗口。预读按extent合并为大块连续读放入块缓存，
+ * 跳读时窗口清零，不再预读。
+ */
+
+/**
+ * @brief 把文件[lblk, lblk + cnt)中尚未缓存的块读入块缓存，调用者持有inode读锁
+ *
+ * @param inode
+ * @param lblk 起始逻辑块
+ * @param cnt 块数
+ */
+static void newfs_ra_fill(struct newfs_inode* inode, int lblk, int cnt) {
+    int blkno, run;
+
+    if (lblk + cnt > inode->blks) {                   /* 不超过文件末尾，文件也可能已被截短 */
+        cnt = inode->blks - lblk;
+    }
+    while (cnt > 0) {
+        blkno = newfs_bmap(inode, lblk, &run);
+        if (blkno < 0) {
+            return;
+        }
+        run = run < cnt ? run : cnt;                  /* 同一extent内的数据块在磁盘上连续 */
+        if (newfs_bcache_prefetch(NEWFS_DATA_OFS(blkno) / NEWFS_BLK_SZ(), run) != NEWFS_ERROR_NONE) {
+            return;
+        }
+        lblk += run;
+        cnt  -= run;
+    }
+}
+/**
+ * @brief 文件的逻辑块lblk是否已在块缓存中，调用者持有inode读锁
+ *
+ * @param inode
+ * @param lblk
+ * @return boolean 空洞或出错时视为已缓存，不为它预读
+ */
+static boolean newfs_ra_cached(struct newfs_inode* inode, int lblk) {
+    struct newfs_buf* buf;
+    int      blkno, run;
+
+    blkno = newfs_bmap(inode, lblk, &run);
+    if (blkno < 0) {
+        return TRUE;
+    }
+    NEWFS_BCACHE_LOCK();
+    buf = newfs_bcache_lookup(NEWFS_DATA_OFS(blkno) / NEWFS_BLK_SZ());
+    NEWFS_BCACHE_UNLOCK();
+    return buf != NULL;
+}
+/**
+ * @brief 在读之前记录本次读，必要时发起预读，调用者持有inode读锁
+ *
+ * @param inode
+ * @param st 打开文件的预读状态，NULL表示不预读
+ * @param offset 本次读的文件偏移
+ * @param size 本次请求读的字节数
+ */
+void newfs_ra_update(struct newfs_inode* inode, struct newfs_ra_state* st, int offset, int size) {
+    struct newfs_ra*    ra = NEWFS_RA();
+    struct newfs_ra_req sync_req, async_req, req;
+    int      first, last, i, n;
+    boolean  is_miss;
+
+    if (st == NULL || ra->max_blks == 0 || offset >= inode->size || size <= 0) {
+        return;
+    }
+    if (size > inode->size - offset) {
+        size = inode->size - offset;
+    }
+    first = offset / NEWFS_BLK_SZ();
+    last  = (offset + size - 1) / NEWFS_BLK_SZ();
+    is_miss = !newfs_ra_cached(inode, first) || !newfs_ra_cached(inode, last);
+    sync_req.cnt  = 0;
+    async_req.cnt = 0;
+
+    pthread_mutex_lock(&ra->lock);
+    if (first != st->next && first != st->next - 1) { /* 跳读：关闭预读，直到再次出现顺序读 */
+        st->window = 0;
+        st->ra_end = 0;
+    }
+    else {
+        if (st->window == 0) {
+            st->window = NEWFS_RA_MIN_BLKS < ra->max_blks ? NEWFS_RA_MIN_BLKS : ra->max_blks;
+        }
+        if (is_miss) {                                /* 本次读的首尾块未缓存：预读没有跟上，同步读入 */
+            sync_req.lblk = first;
+            sync_req.cnt  = st->ra_end > first + st->window ? st->ra_end - first : st->window;
+            sync_req.cnt  = sync_req.cnt > last + 1 - first ? sync_req.cnt : last + 1 - first;
+            st->ra_end    = first + sync_req.cnt;
+            st->window    = st->window * 2 < ra->max_blks ? st->window * 2 : ra->max_blks;
+            for (i = 0, n = 0; i < ra->qcnt; i++) {   /* 丢弃队列中被同步读覆盖的请求 */
+                req = ra->queue[(ra->qhead + i) % NEWFS_RA_QUEUE];
+                if (req.ino == inode->ino && req.lblk < st->ra_end) {
+                    req.cnt  = req.lblk + req.cnt > st->ra_end ? req.lblk + req.cnt - st->ra_end : 0;
+                    req.lblk = st->ra_end;
+                }
+                if (req.cnt > 0) {
+                    ra->queue[(ra->qhead + n++) % NEWFS_RA_QUEUE] = req;
+                }
+            }
+            ra->qcnt = n;
+        }
+        if (st->ra_end - (last + 1) < st->window / 2 && st->ra_end < inode->blks) {
+            async_req.ino  = inode->ino;              /* 已读到预读范围的后半段，发起下一个窗口 */
+            async_req.lblk = st->ra_end;
+            async_req.cnt  = st->window;
+            if (!ra->is_running) {                    /* 没有预读线程：与同步部分（紧邻其后）一起读入 */
+                if (sync_req.cnt == 0) {
+                    sync_req = async_req;
+                }
+                else {
+                    sync_req.cnt += async_req.cnt;
+                }
+            }
+            else if (ra->qcnt == NEWFS_RA_QUEUE) {    /* 队列满：放弃，下次读时重新发起 */
+                ra->dropped++;
+                async_req.cnt = 0;
+            }
+            else {
+                ra->queue[(ra->qhead + ra->qcnt) % NEWFS_RA_QUEUE] = async_req;
+                ra->qcnt++;
+                pthread_cond_signal(&ra->cond);
+            }
+            if (async_req.cnt > 0) {
+                ra->submitted++;
+                st->ra_end += st->window;
+                st->window  = st->window * 2 < ra->max_blks ? st->window * 2 : ra->max_blks;
+            }
+        }
+    }
+    st->next = last + 1;
+    pthread_mutex_unlock(&ra->lock);
+
+    if (sync_req.cnt > 0) {
+        newfs_ra_fill(inode, sync_req.lblk, sync_req.cnt);
+    }
+}
+/**
+ * @brief 预读线程：取出请求后按inode号重新找到文件，在命名空间读锁和inode读锁下读入，
+ * 文件在此期间被删除或截短时放弃或只读剩余部分
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_ra_thread(void* arg) {
+    struct newfs_ra*     ra = NEWFS_RA();
+    struct newfs_ra_req  req;
+    struct newfs_dentry* dentry;
+    struct newfs_inode*  inode;
+    (void)arg;
+
+    pthread_mutex_lock(&ra->lock);
+    while (ra->is_running) {
+        if (ra->qcnt == 0) {
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        req       = ra->queue[ra->qhead];
+        ra->qhead = (ra->qhead + 1) % NEWFS_RA_QUEUE;
+        ra->qcnt--;
+        pthread_mutex_unlock(&ra->lock);
+
+        NEWFS_RDLOCK();
+        dentry = newfs_super.ino_dentry[req.ino];
+        inode  = dentry != NULL ? __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE) : NULL;
+        if (inode != NULL) {
+            NEWFS_INODE_RDLOCK(inode);
+            newfs_ra_fill(inode, req.lblk, req.cnt);
+            NEWFS_INODE_UNLOCK(inode);
+        }
+        NEWFS_UNLOCK();
+        pthread_mutex_lock(&ra->lock);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+/**
+ * @brief 启动预读线程，ra_kb 为0时不预读。窗口上限不超过块缓存的四分之一，
+ * 挂载时块缓存已按 ra_kb 放大，这里的限制只在两者不一致时起作用，挂载后调用
+ *
+ * @param options
+ * @return int 线程创建失败时返回错误，此后预读在读者中同步完成
+ */
+int newfs_ra_start(struct custom_options options) {
+    struct newfs_ra* ra = NEWFS_RA();
+
+    ra->max_blks  = options.ra_kb * 1024 / NEWFS_BLK_SZ();
+    if (ra->max_blks > newfs_super.bcache.nbufs / 4) {   /* 同步和异步两个窗口不超过缓存的一半 */
+        ra->max_blks = newfs_super.bcache.nbufs / 4;
+    }
+    ra->qhead     = 0;
+    ra->qcnt      = 0;
+    ra->submitted = 0;
+    ra->dropped   = 0;
+    if (ra->max_blks <= 0) {
+        ra->max_blks = 0;
+        return NEWFS_ERROR_NONE;
+    }
+
+    pthread_cond_init(&ra->cond, NULL);
+    pthread_mutex_lock(&ra->lock);
+    ra->is_running = TRUE;
+    pthread_mutex_unlock(&ra->lock);
+    if (pthread_create(&ra->tid, NULL, newfs_ra_thread, NULL) != 0) {
+        ra->is_running = FALSE;
+        pthread_cond_destroy(&ra->cond);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 停止预读线程，丢弃未处理的请求，卸载前调用
+ *
+ */
+void newfs_ra_stop() {
+    struct newfs_ra* ra = NEWFS_RA();
+
+    if (ra->is_running) {
+        pthread_mutex_lock(&ra->lock);
+        ra->is_running = FALSE;
+        pthread_cond_signal(&ra->cond);
+        pthread_mutex_unlock(&ra->lock);
+        pthread_join(ra->tid, NULL);
+        pthread_cond_destroy(&ra->cond);
+    }
+    if (ra->max_blks > 0) {
+        NEWFS_DBG("[%s] readahead requests %d, dropped %d\n", __func__, ra->submitted, ra->dropped);
+    }
+    ra->max_blks = 0;
+}
@@ -0,0 +1,197 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_SLAB_HDR                    NEWFS_SLAB_ALIGN    // 大块首部，存放下一块的地址
+
+/**
+ * 内存dentry、inode和名字都从slab中分配：每次向系统申请 NEWFS_SLAB_CHUNK_SZ 字节的大块，
+ * 从中依次切出定长对象，归还的对象挂在空闲链上优先复用。名字按长度分为16/32/64/128字节
+ * 四级，dentry中只留一个指针。卸载时逐个大块释放，不必遍历目录树。
+ */
+
+/**
+ * @brief 初始化slab
+ *
+ * @param slab
+ * @param obj_sz 对象大小
+ * @return int
+ */
+int newfs_slab_init(struct newfs_slab* slab, int obj_sz) {
+    memset(slab, 0, sizeof(struct newfs_slab));
+    slab->obj_sz    = NEWFS_ROUND_UP(obj_sz, NEWFS_SLAB_ALIGN);
+    slab->per_chunk = (NEWFS_SLAB_CHUNK_SZ - NEWFS_SLAB_HDR) / slab->obj_sz;
+    if (slab->per_chunk < 1) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    slab->carved    = slab->per_chunk;              /* 首次分配时申请大块 */
+    pthread_mutex_init(&slab->lock, NULL);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放slab的全部大块，其中的对象一并失效
+ *
+ * @param slab
+ */
+void newfs_slab_destroy(struct newfs_slab* slab) {
+    uint8_t* chunk;
+
+    while (slab->chunks != NULL) {
+        chunk        = slab->chunks;
+        slab->chunks = *(uint8_t **)chunk;
+        free(chunk);
+    }
+    slab->free_list = NULL;
+    slab->carved    = slab->per_chunk;
+    pthread_mutex_destroy(&slab->lock);
+}
+/**
+ * @brief 分配一个清零的对象
+ *
+ * @param slab
+ * @return void* 内存不足返回NULL
+ */
+void* newfs_slab_alloc(struct newfs_slab* slab) {
+    uint8_t* chunk;
+    void*    obj;
+
+    pthread_mutex_lock(&slab->lock);
+    if (slab->free_list != NULL) {
+        obj             = slab->free_list;
+        slab->free_list = *(void **)obj;
+    }
+    else {
+        if (slab->carved == slab->per_chunk) {
+            chunk = (uint8_t *)malloc(NEWFS_SLAB_CHUNK_SZ);
+            if (chunk == NULL) {
+                pthread_mutex_unlock(&slab->lock);
+                return NULL;
+            }
+            *(uint8_t **)chunk = slab->chunks;
+            slab->chunks = chunk;
+            slab->carved = 0;
+        }
+        obj = slab->chunks + NEWFS_SLAB_HDR + slab->carved * slab->obj_sz;
+        slab->carved++;
+    }
+    pthread_mutex_unlock(&slab->lock);
+    memset(obj, 0, slab->obj_sz);
+    return obj;
+}
+/**
+ * @brief 归还对象
+ *
+ * @param slab
+ * @param obj 可为NULL
+ */
+void newfs_slab_free(struct newfs_slab* slab, void* obj) {
+    if (obj == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&slab->lock);
+    *(void **)obj   = slab->free_list;
+    slab->free_list = obj;
+    pthread_mutex_unlock(&slab->lock);
+}
+/**
+ * @brief 初始化dentry、inode和名字slab，挂载时调用
+ *
+ * @return int
+ */
+int newfs_slabs_init() {
+    int c;
+
+    if (newfs_slab_init(&newfs_super.slab_dentry, sizeof(struct newfs_dentry)) != NEWFS_ERROR_NONE ||
+        newfs_slab_init(&newfs_super.slab_inode, sizeof(struct newfs_inode)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    for (c = 0; c < NEWFS_NAME_CLASSES; c++) {
+        if (newfs_slab_init(&newfs_super.slab_name[c], NEWFS_SLAB_ALIGN << c) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_INVAL;
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 卸载时整体释放全部dentry、inode和名字
+ */
+void newfs_slabs_destroy() {
+    int c;
+
+    newfs_slab_destroy(&newfs_super.slab_dentry);
+    newfs_slab_destroy(&newfs_super.slab_inode);
+    for (c = 0; c < NEWFS_NAME_CLASSES; c++) {
+        newfs_slab_destroy(&newfs_super.slab_name[c]);
+    }
+}
+/**
+ * @brief 长度为len（含结尾0）的名字所在的级别
+ *
+ * @param len
+ * @return int
+ */
+static inline int newfs_name_class(int len) {
+    int c = 0;
+    while ((NEWFS_SLAB_ALIGN << c) < len) {
+        c++;
+    }
+    return c;
+}
+/**
+ * @brief 复制名字到名字slab，超过MAX_NAME_LEN - 1的部分截去
+ *
+ * @param name
+ * @return char* 内存不足返回NULL
+ */
+char* newfs_name_dup(const char* name) {
+    int   len = strnlen(name, MAX_NAME_LEN - 1);
+    char* copy;
+
+    copy = (char *)newfs_slab_alloc(&newfs_super.slab_name[newfs_name_class(len + 1)]);
+    if (copy != NULL) {
+        memcpy(copy, name, len);                    /* 已清零，结尾0不必再写 */
+    }
+    return copy;
+}
+/**
+ * @brief 归还newfs_name_dup得到的名字
+ *
+ * @param name 可为NULL
+ */
+void newfs_name_free(char* name) {
+    if (name == NULL) {
+        return;
+    }
+    newfs_slab_free(&newfs_super.slab_name[newfs_name_class(strlen(name) + 1)], name);
+}
+/**
+ * @brief 新建内存dentry
+ *
+ * @param fname
+ * @param ftype
+ * @return struct newfs_dentry* 内存不足返回NULL
+ */
+struct newfs_dentry* new_dentry(const char* fname, FILE_TYPE ftype) {
+    struct newfs_dentry* dentry = (struct newfs_dentry *)newfs_slab_alloc(&newfs_super.slab_dentry);
+
+    if (dentry == NULL) {
+        return NULL;
+    }
+    dentry->name = newfs_name_dup(fname);
+    if (dentry->name == NULL) {
+        newfs_slab_free(&newfs_super.slab_dentry, dentry);
+        return NULL;
+    }
+    dentry->ftype   = ftype;
+    dentry->ino     = -1;
+    return dentry;
+}
+/**
+ * @brief 释放内存dentry及其名字
+ *
+ * @param dentry
+ */
+void free_dentry(struct newfs_dentry* dentry) {
+    newfs_name_free(dentry->name);
+    newfs_slab_free(&newfs_super.slab_dentry, dentry);
+}
@@ -41,7 +41,7 @@ int newfs_calc_lvl(const char * path) {
     return lvl;
 }
 /**
- * @brief 驱动读
+ * @brief 驱动读，经过块缓存
  * 
  * @param offset 
  * @param out_content 
@@ -49,239 +49,1499 @@ int newfs_calc_lvl(const char * path) {
  * @return int 
  */
 int newfs_driver_read(int offset, uint8_t *out_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    int      blkno = offset / NEWFS_BLK_SZ();
+    int      bias  = offset % NEWFS_BLK_SZ();
+    int      len;
+    struct newfs_buf* buf;
+
+    while (size > 0)
+    {
+        len = NEWFS_BLK_SZ() - bias;
+        if (len > size) {
+            len = size;
+        }
+        NEWFS_BCACHE_LOCK();
+        buf = newfs_bcache_get(blkno, TRUE);
+        if (buf == NULL) {
+            NEWFS_BCACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(out_content, buf->data + bias, len);
+        NEWFS_BCACHE_UNLOCK();
+        out_content += len;
+        size        -= len;
+        bias         = 0;
+        blkno++;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 驱动写，写入块缓存并标脏，由淘汰或 newfs_bcache_flush 回写
+ * 
+ * @param offset 
+ * @param in_content 
+ * @param size 
+ * @return int 
+ */
+int newfs_driver_write(int offset, uint8_t *in_content, int size) {
+    int      blkno = offset / NEWFS_BLK_SZ();
+    int      bias  = offset % NEWFS_BLK_SZ();
+    int      len;
+    struct newfs_buf* buf;
+
+    while (size > 0)
     {
-        // read(DRIVER(), cur, IO_SZ());
-        ddriver_read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+        len = NEWFS_BLK_SZ() - bias;
+        if (len > size) {
+            len = size;
+        }
+        /* 整块覆盖时无需先读出原内容 */
+        NEWFS_BCACHE_LOCK();
+        buf = newfs_bcache_get(blkno, len != NEWFS_BLK_SZ());
+        if (buf == NULL) {
+            NEWFS_BCACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(buf->data + bias, in_content, len);
+        newfs_bcache_mark_dirty(buf);
+        NEWFS_BCACHE_UNLOCK();
+        in_content += len;
+        size       -= len;
+        bias        = 0;
+        blkno++;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 提交一批连续段
+ * 
+ * @param reqs 
+ * @param n 段数
+ * @return int 
+ */
+static int newfs_driver_batch(struct newfs_dev_req* reqs, int n) {
+    if (n == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_dev_submit(reqs, n);
+}
+/**
+ * @brief 块已缓存时直接与缓存块交换整块数据。写入出现在未做检查点的事务中的块时同样经过缓存，
+ * 使新内容进入下一个事务，重放时不会被旧的元数据覆盖
+ * 
+ * @param blkno 块号
+ * @param base 内存地址
+ * @param is_write 
+ * @return boolean 块未缓存返回FALSE
+ */
+static boolean newfs_driver_cached(int blkno, uint8_t* base, boolean is_write) {
+    struct newfs_buf* buf;
+
+    NEWFS_BCACHE_LOCK();
+    buf = newfs_bcache_lookup(blkno);
+    if (buf == NULL && is_write && newfs_journal_is_logged(blkno)) {
+        buf = newfs_bcache_get(blkno, FALSE);         /* 出错时buf为NULL，退回直接写盘 */
+    }
+    if (buf != NULL) {
+        if (is_write) {
+            memcpy(buf->data, base, NEWFS_BLK_SZ());
+            newfs_bcache_mark_dirty(buf);
+        }
+        else {
+            memcpy(base, buf->data, NEWFS_BLK_SZ());
+        }
+    }
+    NEWFS_BCACHE_UNLOCK();
+    return buf != NULL;
+}
+/**
+ * @brief 分散/聚集IO，用于大块数据传输
+ * 
+ * 对齐的整块不做读改写：已缓存的块直接与缓存交换数据，其余块直接在调用者内存与设备之间传输，
+ * 磁盘上连续的块（包括跨iov的连续段）合并为一段，每 NEWFS_DEV_BATCH 块的各段一起提交。不对齐的首尾部分经过块缓存。
+ * iov应按磁盘偏移递增给出，且各段互不重叠。
+ * 
+ * @param iov 
+ * @param iovcnt 
+ * @param is_write 
+ * @return int 
+ */
+static int newfs_driver_rwv(struct newfs_iovec* iov, int iovcnt, boolean is_write) {
+    uint8_t*             blks[NEWFS_DEV_BATCH];
+    struct newfs_dev_req reqs[NEWFS_DEV_BATCH];
+    int      nblk = 0;
+    int      nreq = 0;
+    int      i, offset, size, blkno, len;
+    uint8_t* base;
+
+    for (i = 0; i < iovcnt; i++) {
+        offset = iov[i].offset;
+        base   = iov[i].base;
+        size   = iov[i].size;
+        while (size > 0)
+        {
+            blkno = offset / NEWFS_BLK_SZ();
+            len   = NEWFS_BLK_SZ() - offset % NEWFS_BLK_SZ();
+            if (len > size) {
+                len = size;
+            }
+            if (len != NEWFS_BLK_SZ()) {              /* 不对齐部分：读改写经过缓存 */
+                if ((is_write ? newfs_driver_write(offset, base, len) 
+                              : newfs_driver_read(offset, base, len)) != NEWFS_ERROR_NONE) {
+                    return -NEWFS_ERROR_IO;
+                }
+            }
+            else if (!newfs_driver_cached(blkno, base, is_write)) {   /* 对齐整块：并入当前批 */
+                if (nblk == NEWFS_DEV_BATCH) {
+                    if (newfs_driver_batch(reqs, nreq) != NEWFS_ERROR_NONE) {
+                        return -NEWFS_ERROR_IO;
+                    }
+                    nblk = 0;
+                    nreq = 0;
+                }
+                if (nreq == 0 || reqs[nreq - 1].offset + (off_t)reqs[nreq - 1].cnt * NEWFS_BLK_SZ() != 
+                                 (off_t)blkno * NEWFS_BLK_SZ()) {
+                    reqs[nreq].offset   = (off_t)blkno * NEWFS_BLK_SZ();
+                    reqs[nreq].bufs     = &blks[nblk];
+                    reqs[nreq].cnt      = 0;
+                    reqs[nreq].is_write = is_write;
+                    nreq++;
+                }
+                reqs[nreq - 1].cnt++;
+                blks[nblk++] = base;
+            }
+            offset += len;
+            base   += len;
+            size   -= len;
+        }
+    }
+    if (newfs_driver_batch(reqs, nreq) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 分散读，见 newfs_driver_rwv
+ * 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 
+ */
+int newfs_driver_readv(struct newfs_iovec* iov, int iovcnt) {
+    return newfs_driver_rwv(iov, iovcnt, FALSE);
+}
+/**
+ * @brief 聚集写，见 newfs_driver_rwv
+ * 
+ * @param iov 
+ * @param iovcnt 
+ * @return int 
+ */
+int newfs_driver_writev(struct newfs_iovec* iov, int iovcnt) {
+    return newfs_driver_rwv(iov, iovcnt, TRUE);
+}
+/**
+ * @brief 名字哈希（FNV-1a）
+ * 
+ * @param name 
+ * @return uint32_t 
+ */
+uint32_t newfs_hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+/**
+ * @brief 将dentry放入索引表，调用者保证有空位
+ * 
+ * @param index 索引表
+ * @param cap 索引容量，2的幂
+ * @param dentry 
+ * @return int 占用了原本为空（而非删除标记）的槽位时返回1
+ */
+static int newfs_index_put(struct newfs_dentry** index, int cap, struct newfs_dentry* dentry) {
+    int mask = cap - 1;
+    int slot = dentry->hash & mask;
+    int is_new;
+    while (index[slot] != NULL && index[slot] != NEWFS_INDEX_TOMB) {
+        slot = (slot + 1) & mask;
+    }
+    is_new      = index[slot] == NULL;
+    index[slot] = dentry;
+    return is_new;
+}
+/**
+ * @brief 按目录项数量（重新）建立目录索引，同时清除删除标记。
+ * 新表填好后才挂到inode上，持命名空间读锁的查找看到的总是完整的索引
+ * 
+ * @param inode 目录inode
+ * @return int 
+ */
+static int newfs_index_build(struct newfs_inode* inode) {
+    struct newfs_dentry*  dentry_cursor = inode->dentrys;
+    struct newfs_dentry** index;
+    int cap  = NEWFS_INDEX_MIN_CAP;
+    int used = 0;
+    while (cap < inode->dir_cnt * 2) {
+        cap <<= 1;
+    }
+    index = (struct newfs_dentry**)calloc(cap, sizeof(struct newfs_dentry*));
+    if (index == NULL) {
+        free(inode->index);
+        inode->index     = NULL;
+        inode->index_cap = 0;
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    while (dentry_cursor) {
+        used += newfs_index_put(index, cap, dentry_cursor);
+        dentry_cursor = dentry_cursor->brother;
+    }
+    free(inode->index);                               /* 重建只发生在持写锁时，无并发读者 */
+    inode->index_cap  = cap;
+    inode->index_used = used;
+    __atomic_store_n(&inode->index, index, __ATOMIC_RELEASE);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 在目录中按名字查找目录项，索引不存在时先建立
+ * 
+ * @param inode 目录inode
+ * @param fname 
+ * @return struct newfs_dentry* 未找到返回NULL
+ */
+struct newfs_dentry* newfs_index_find(struct newfs_inode* inode, const char* fname) {
+    struct newfs_dentry* dentry;
+    struct newfs_dentry** index;
+    uint32_t hash = newfs_hash_name(fname);
+    int      mask, slot;
+
+    index = __atomic_load_n(&inode->index, __ATOMIC_ACQUIRE);
+    if (index == NULL) {                              /* 并发查找同一目录时只建立一次 */
+        pthread_mutex_lock(&newfs_super.load_lock);
+        if (inode->index == NULL && newfs_index_build(inode) != NEWFS_ERROR_NONE) {
+            pthread_mutex_unlock(&newfs_super.load_lock);
+            return NULL;
+        }
+        index = inode->index;
+        pthread_mutex_unlock(&newfs_super.load_lock);
+    }
+    mask = inode->index_cap - 1;
+    slot = hash & mask;
+    while ((dentry = index[slot]) != NULL) {
+        if (dentry != NEWFS_INDEX_TOMB && dentry->hash == hash && 
+            strcmp(dentry->name, fname) == 0) {
+            return dentry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+/**
+ * @brief 将目录项从目录索引中移除，留下删除标记
+ * 
+ * @param inode 目录inode
+ * @param dentry 
+ */
+void newfs_index_remove(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    int mask, slot;
+    if (inode->index == NULL) {
+        return;
+    }
+    mask = inode->index_cap - 1;
+    slot = dentry->hash & mask;
+    while (inode->index[slot] != NULL) {
+        if (inode->index[slot] == dentry) {
+            inode->index[slot] = NEWFS_INDEX_TOMB;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+/**
+ * @brief 保证槽位数组末尾至少还有一个位置，之后加入目录项不会失败
+ * 
+ * @param inode 目录inode
+ * @return int 
+ */
+static int newfs_slot_reserve(struct newfs_inode* inode) {
+    struct newfs_dentry** slots;
+    int cap;
+
+    if (inode->slot_cnt < inode->slot_cap) {
+        return NEWFS_ERROR_NONE;
+    }
+    cap   = inode->slot_cap > 0 ? inode->slot_cap * 2 : NEWFS_SLOTS_MIN;
+    slots = (struct newfs_dentry **)realloc(inode->slots, cap * sizeof(struct newfs_dentry *));
+    if (slots == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->slots    = slots;
+    inode->slot_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 没有打开的目录句柄时把目录项依次前移、去掉空槽，顺序不变。调用者持有命名空间写锁，
+ * 打开目录在命名空间读锁下计数，因此压缩期间不会有新的句柄
+ * 
+ * @param inode 目录inode
+ */
+static void newfs_slot_compact(struct newfs_inode* inode) {
+    int from, to = 0;
+
+    for (from = 0; from < inode->slot_cnt; from++) {
+        if (inode->slots[from] != NULL) {
+            inode->slots[to]      = inode->slots[from];
+            inode->slots[to]->pos = to;
+            to++;
+        }
+    }
+    inode->slot_cnt  = to;
+    inode->slot_hint = to;
+}
+/**
+ * @brief 保证目录中有一个目录块能放下rec_len字节的目录项，都放不下时分配一个新的目录块，目录块只在需要时分配
+ * 
+ * @param inode 目录inode
+ * @param rec_len 目录项记录长度，见NEWFS_DENTRY_REC_LEN
+ * @return int 
+ */
+int newfs_dir_grow(struct newfs_inode* inode, int rec_len) {
+    int* dir_free;
+    int  blk, ret;
+
+    if ((ret = newfs_slot_reserve(inode)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    for (blk = 0; blk < inode->blks; blk++) {
+        if (inode->dir_free[blk] >= rec_len) {
+            return NEWFS_ERROR_NONE;
+        }
+    }
+    dir_free = (int *)realloc(inode->dir_free, (inode->blks + 1) * sizeof(int));
+    if (dir_free == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->dir_free = dir_free;
+    if ((ret = newfs_extend(inode, 1)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    inode->dir_free[inode->blks - 1] = NEWFS_BLK_SZ();
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将dentry挂入目录的链表和索引。槽位优先复用删除留下的空槽，没有时接在末尾，
+ * 已有目录项的槽位不变，按槽位续读的目录句柄不会漏掉或重复已有的目录项。
+ * 调用者已用 newfs_slot_reserve 保证末尾有位置
+ * 
+ * @param inode 目录inode
+ * @param dentry 已确定所在目录块和名字哈希
+ */
+static void newfs_link_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    while (inode->slot_hint < inode->slot_cnt && inode->slots[inode->slot_hint] != NULL) {
+        inode->slot_hint++;
+    }
+    if (inode->slot_hint == inode->slot_cnt) {
+        inode->slot_cnt++;
+    }
+    dentry->pos = inode->slot_hint++;
+    inode->slots[dentry->pos] = dentry;
+
+    if (inode->dentrys == NULL) {
+        inode->dentrys = dentry;
+    }
+    else {
+        dentry->brother = inode->dentrys;
+        inode->dentrys = dentry;
+    }
+    inode->dir_cnt++;
+    if (inode->index != NULL) {                       /* 索引已建立则同步更新，装载率超过3/4时扩容 */
+        if ((inode->index_used + 1) * 4 > inode->index_cap * 3) {
+            newfs_index_build(inode);
+        }
+        else {
+            inode->index_used += newfs_index_put(inode->index, inode->index_cap, dentry);
+        }
+    }
+}
+/**
+ * @brief 为一个inode分配dentry的bro，采用头插法，记录放入第一个放得下的目录块
+ * 
+ * @param inode 
+ * @param dentry 
+ * @return int 目录项数，空间不足时返回错误码
+ */
+int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    int rec_len = NEWFS_DENTRY_REC_LEN(strlen(dentry->name));
+    int ret;
+
+    if ((ret = newfs_dir_grow(inode, rec_len)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    for (dentry->blk = 0; inode->dir_free[dentry->blk] < rec_len; dentry->blk++) {
+        ;
+    }
+    inode->dir_free[dentry->blk] -= rec_len;
+    dentry->hash = newfs_hash_name(dentry->name);
+    newfs_link_dentry(inode, dentry);
+    return inode->dir_cnt;
+}
+/**
+ * @brief 将dentry从目录中摘除，它的槽位留空，供之后新建的目录项复用；末尾的空槽直接收回，
+ * 空槽超过一半且没有打开的目录句柄时压缩。记录仍留在原目录块中，空出的目录块由newfs_dir_trim归还
+ * 
+ * @param inode 目录inode
+ * @param dentry 
+ * @return int 剩余目录项数
+ */
+int newfs_drop_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** pprev = &inode->dentrys;
+
+    while (*pprev) {
+        if (*pprev == dentry) {
+            *pprev = dentry->brother;
+            break;
+        }
+        pprev = &(*pprev)->brother;
+    }
+    newfs_index_remove(inode, dentry);
+    newfs_dirty_dentry(inode, dentry);
+    inode->dir_free[dentry->blk] += NEWFS_DENTRY_REC_LEN(strlen(dentry->name));
+    inode->slots[dentry->pos] = NULL;
+    if (dentry->pos < inode->slot_hint) {
+        inode->slot_hint = dentry->pos;
+    }
+    while (inode->slot_cnt > 0 && inode->slots[inode->slot_cnt - 1] == NULL) {
+        inode->slot_cnt--;
+    }
+    if (inode->slot_hint > inode->slot_cnt) {
+        inode->slot_hint = inode->slot_cnt;
+    }
+    dentry->brother = NULL;
+    inode->dir_cnt--;
+    if ((inode->slot_cnt - inode->dir_cnt) * 2 > inode->slot_cnt &&
+        __atomic_load_n(&newfs_super.dir_opens, __ATOMIC_ACQUIRE) == 0) {
+        newfs_slot_compact(inode);
+    }
+    return inode->dir_cnt;
+}
+/**
+ * @brief 归还目录末尾已经没有目录项的目录块
+ * 
+ * @param inode 目录inode
+ */
+void newfs_dir_trim(struct newfs_inode* inode) {
+    int blks = inode->blks;
+
+    while (blks > 0 && inode->dir_free[blks - 1] == NEWFS_BLK_SZ()) {
+        blks--;
+    }
+    if (blks < inode->blks) {
+        newfs_shrink(inode, blks);
+    }
+}
+/**
+ * @brief 标记inode需要回写，挂入super的脏链表
+ * 
+ * @param inode 
+ */
+void newfs_dirty_inode(struct newfs_inode* inode) {
+    if (!(inode->flag & NEWFS_FLAG_INODE_DIRTY)) {
+        inode->flag |= NEWFS_FLAG_INODE_DIRTY;
+        newfs_mark_dirty(NEWFS_INODE_SZ());
+    }
+    if (!(inode->flag & NEWFS_FLAG_INODE_LISTED)) {   /* flag由inode写锁或命名空间写锁保护，链表由回写锁保护 */
+        inode->flag |= NEWFS_FLAG_INODE_LISTED;
+        pthread_mutex_lock(&newfs_super.wb.lock);
+        inode->dirty_next = newfs_super.dirty_inodes;
+        newfs_super.dirty_inodes = inode;
+        pthread_mutex_unlock(&newfs_super.wb.lock);
+    }
+}
+/**
+ * @brief 标记目录inode中dentry所在的目录块需要回写，目录项数量随之变化，inode本身也需回写
+ * 
+ * @param inode 目录inode
+ * @param dentry 发生变化的目录项
+ */
+void newfs_dirty_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    uint32_t blk_mask = NEWFS_DIRTY_BLK_MASK(dentry->blk);
+    if (!(inode->dirty_blks & blk_mask)) {
+        inode->dirty_blks |= blk_mask;
+        newfs_mark_dirty(NEWFS_BLK_SZ());
+    }
+    newfs_dirty_inode(inode);
+}
+/**
+ * @brief 第k个存放extent的间接块：k = 0 为一级间接块，k >= 1 为二级间接块下的第k-1块
+ * 
+ * @param inode 
+ * @param k 
+ * @return int 块号
+ */
+static inline int newfs_map_blk(struct newfs_inode* inode, int k) {
+    return k == 0 ? inode->ext_ind : inode->dind_blks[k - 1];
+}
+/**
+ * @brief 自下标idx起的extent发生了变化，回写inode时一并回写所在的间接块
+ * 
+ * @param inode 
+ * @param idx 
+ */
+static void newfs_dirty_extent(struct newfs_inode* inode, int idx) {
+    int per  = NEWFS_EXTENT_PER_BLK();
+    int from = inode->ext_dirty_from;
+    int k_old, k_new;
+
+    if (idx < from) {                                 /* 回写时从所在间接块起写到最后一块，计入新增的块数 */
+        if (from == INT32_MAX) {
+            k_old = inode->ext_cnt > NEWFS_EXTENT_DIRECT ? (inode->ext_cnt - NEWFS_EXTENT_DIRECT + per - 1) / per : 0;
+        }
+        else {
+            k_old = from > NEWFS_EXTENT_DIRECT ? (from - NEWFS_EXTENT_DIRECT) / per : 0;
+        }
+        k_new = idx > NEWFS_EXTENT_DIRECT ? (idx - NEWFS_EXTENT_DIRECT) / per : 0;
+        if (k_old > k_new) {
+            newfs_mark_dirty((k_old - k_new) * NEWFS_BLK_SZ());
+        }
+        inode->ext_dirty_from = idx;
+    }
+    newfs_dirty_inode(inode);
+}
+/**
+ * @brief extent减少后释放不再需要的间接块
+ * 
+ * @param inode 
+ */
+static void newfs_map_trim(struct newfs_inode* inode) {
+    int spill = inode->ext_cnt - NEWFS_EXTENT_DIRECT;
+    int nblks = spill <= 0 ? 0 : (spill + NEWFS_EXTENT_PER_BLK() - 1) / NEWFS_EXTENT_PER_BLK();
+
+    while (inode->dind_cnt > 0 && inode->dind_cnt >= nblks) {
+        newfs_bitmap_free(&newfs_super.bm_data, inode->dind_blks[--inode->dind_cnt]);
+        inode->is_dind_dirty = TRUE;
+    }
+    if (inode->dind_cnt == 0 && inode->ext_dind != NEWFS_BLK_NONE) {
+        newfs_bitmap_free(&newfs_super.bm_data, inode->ext_dind);
+        inode->ext_dind = NEWFS_BLK_NONE;
+        inode->is_dind_dirty = FALSE;
+        free(inode->dind_blks);
+        inode->dind_blks = NULL;
+    }
+    if (nblks == 0 && inode->ext_ind != NEWFS_BLK_NONE) {
+        newfs_bitmap_free(&newfs_super.bm_data, inode->ext_ind);
+        inode->ext_ind = NEWFS_BLK_NONE;
+    }
+}
+/**
+ * @brief 数据块分配的起点：inode所在块组的第一个数据块，使inode与其数据在同一块组
+ * 
+ * @param inode 
+ * @return int 
+ */
+static int newfs_data_goal(struct newfs_inode* inode) {
+    int goal = NEWFS_INO_GROUP(inode->ino) * newfs_super.data_per_group;
+    return goal < newfs_super.max_data ? goal : -1;
+}
+/**
+ * @brief 追加第idx个extent前，确保存放它的间接块已分配
+ * 
+ * @param inode 
+ * @param idx 新extent的下标
+ * @return int 
+ */
+static int newfs_map_reserve(struct newfs_inode* inode, int idx) {
+    int per = NEWFS_EXTENT_PER_BLK();
+    int k, blkno;
+
+    if (idx < NEWFS_EXTENT_DIRECT || (idx - NEWFS_EXTENT_DIRECT) % per != 0) {
+        return NEWFS_ERROR_NONE;                      /* 直接extent，或所在间接块已存在 */
+    }
+    if (idx >= NEWFS_EXTENT_MAX()) {
+        return -NEWFS_ERROR_FBIG;
+    }
+    k = (idx - NEWFS_EXTENT_DIRECT) / per;
+    if (k >= 1 && inode->ext_dind == NEWFS_BLK_NONE) {
+        inode->dind_blks = (int *)malloc(NEWFS_PTR_PER_BLK() * sizeof(int));
+        if (inode->dind_blks == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        if ((blkno = newfs_bitmap_alloc(&newfs_super.bm_data, newfs_data_goal(inode))) < 0) {
+            free(inode->dind_blks);
+            inode->dind_blks = NULL;
+            return blkno;
+        }
+        inode->ext_dind = blkno;
+    }
+    if ((blkno = newfs_bitmap_alloc(&newfs_super.bm_data, newfs_data_goal(inode))) < 0) {
+        newfs_map_trim(inode);
+        return blkno;
+    }
+    if (k == 0) {
+        inode->ext_ind = blkno;
+    }
+    else {
+        inode->dind_blks[inode->dind_cnt++] = blkno;
+        inode->is_dind_dirty = TRUE;
+    }
+    newfs_mark_dirty((k == 0 ? 1 : 2) * NEWFS_BLK_SZ());   /* 新的间接块，以及二级间接块 */
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将变化过的extent写入间接块（经块缓存）
+ * 
+ * @param inode 
+ * @return int 
+ */
+static int newfs_sync_extents(struct newfs_inode* inode) {
+    struct newfs_buf* buf;
+    int per = NEWFS_EXTENT_PER_BLK();
+    int from = inode->ext_dirty_from;
+    int k, n;
+
+    if (from < NEWFS_EXTENT_DIRECT) {
+        from = NEWFS_EXTENT_DIRECT;
+    }
+    NEWFS_BCACHE_LOCK();
+    for (k = (from - NEWFS_EXTENT_DIRECT) / per; 
+         from < inode->ext_cnt && NEWFS_EXTENT_DIRECT + k * per < inode->ext_cnt; k++) {
+        buf = newfs_bcache_get(NEWFS_DATA_OFS(newfs_map_blk(inode, k)) / NEWFS_BLK_SZ(), FALSE);
+        if (buf == NULL) {
+            NEWFS_BCACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        n = inode->ext_cnt - NEWFS_EXTENT_DIRECT - k * per;
+        n = n < per ? n : per;
+        memset(buf->data, 0, NEWFS_BLK_SZ());
+        memcpy(buf->data, &inode->extents[NEWFS_EXTENT_DIRECT + k * per], n * sizeof(struct newfs_extent));
+        newfs_bcache_mark_dirty(buf);
+    }
+    if (inode->is_dind_dirty) {
+        buf = newfs_bcache_get(NEWFS_DATA_OFS(inode->ext_dind) / NEWFS_BLK_SZ(), FALSE);
+        if (buf == NULL) {
+            NEWFS_BCACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memset(buf->data, 0, NEWFS_BLK_SZ());
+        memcpy(buf->data, inode->dind_blks, inode->dind_cnt * sizeof(int));
+        newfs_bcache_mark_dirty(buf);
+        inode->is_dind_dirty = FALSE;
+    }
+    NEWFS_BCACHE_UNLOCK();
+    inode->ext_dirty_from = INT32_MAX;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读入间接块中的extent，此后映射只查内存，不再读间接块
+ * 
+ * @param inode ext_cnt、ext_ind、ext_dind已从磁盘inode中取得
+ * @return int 
+ */
+static int newfs_load_extents(struct newfs_inode* inode) {
+    struct newfs_buf* buf;
+    int per = NEWFS_EXTENT_PER_BLK();
+    int k, n;
+    int ret = NEWFS_ERROR_NONE;
+
+    NEWFS_BCACHE_LOCK();
+    if (inode->ext_dind != NEWFS_BLK_NONE) {
+        buf = newfs_bcache_get(NEWFS_DATA_OFS(inode->ext_dind) / NEWFS_BLK_SZ(), TRUE);
+        inode->dind_blks = (int *)malloc(NEWFS_PTR_PER_BLK() * sizeof(int));
+        if (buf == NULL || inode->dind_blks == NULL) {
+            NEWFS_BCACHE_UNLOCK();
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(inode->dind_blks, buf->data, NEWFS_PTR_PER_BLK() * sizeof(int));
+        inode->dind_cnt = (inode->ext_cnt - NEWFS_EXTENT_DIRECT - 1) / per;
+    }
+    for (k = 0; NEWFS_EXTENT_DIRECT + k * per < inode->ext_cnt; k++) {
+        buf = newfs_bcache_get(NEWFS_DATA_OFS(newfs_map_blk(inode, k)) / NEWFS_BLK_SZ(), TRUE);
+        if (buf == NULL) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        n = inode->ext_cnt - NEWFS_EXTENT_DIRECT - k * per;
+        n = n < per ? n : per;
+        memcpy(&inode->extents[NEWFS_EXTENT_DIRECT + k * per], buf->data, n * sizeof(struct newfs_extent));
+    }
+    NEWFS_BCACHE_UNLOCK();
+    return ret;
+}
+/**
+ * @brief 释放inode占用的数据块和inode位，并释放内存结构
+ * 
+ * @param inode 
+ */
+static void newfs_free_inode(struct newfs_inode* inode) {
+    struct newfs_inode** pprev;
+    int i;
+
+    for (i = 0; i < inode->ext_cnt; i++) {
+        newfs_bitmap_free_run(&newfs_super.bm_data, inode->extents[i].start, inode->extents[i].len);
+    }
+    inode->ext_cnt = 0;
+    newfs_map_trim(inode);
+    newfs_bitmap_free(&newfs_super.bm_inode, inode->ino);
+    newfs_super.ino_dentry[inode->ino] = NULL;
+
+    if (inode->flag & NEWFS_FLAG_INODE_LISTED) {      /* 从脏链表上摘下，磁盘上的旧inode无需回写 */
+        pthread_mutex_lock(&newfs_super.wb.lock);
+        for (pprev = &newfs_super.dirty_inodes; *pprev != NULL; pprev = &(*pprev)->dirty_next) {
+            if (*pprev == inode) {
+                *pprev = inode->dirty_next;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&newfs_super.wb.lock);
+    }
+    pthread_rwlock_destroy(&inode->lock);
+    free(inode->extents);
+    free(inode->dind_blks);
+    free(inode->index);
+    free(inode->dir_free);
+    free(inode->slots);
+    newfs_slab_free(&newfs_super.slab_inode, inode);
+}
+/**
+ * @brief 逻辑块号映射为数据块号，extent按逻辑顺序首尾相接
+ * 
+ * @param inode 
+ * @param lblk 文件内的逻辑块号
+ * @param run 输出，从lblk起在同一extent内连续的块数，可为NULL
+ * @return int 数据块号，超出已分配范围返回 -NEWFS_ERROR_NOSPACE
+ */
+int newfs_bmap(struct newfs_inode* inode, int lblk, int* run) {
+    uint64_t hint = __atomic_load_n(&inode->ext_hint, __ATOMIC_RELAXED);  /* 持inode读锁的读者会并发更新 */
+    int i    = 0;
+    int base = 0;                                     /* extents[i]的起始逻辑块号 */
+
+    if ((int)(uint32_t)hint < inode->ext_cnt && lblk >= (int)(hint >> 32)) {
+        i    = (int)(uint32_t)hint;                   /* 顺序访问从上次命中处继续 */
+        base = (int)(hint >> 32);
+    }
+    for (; i < inode->ext_cnt; i++) {
+        if (lblk < base + inode->extents[i].len) {
+            __atomic_store_n(&inode->ext_hint, ((uint64_t)base << 32) | (uint32_t)i, __ATOMIC_RELAXED);
+            if (run != NULL) {
+                *run = base + inode->extents[i].len - lblk;
+            }
+            return inode->extents[i].start + lblk - base;
+        }
+        base += inode->extents[i].len;
+    }
+    return -NEWFS_ERROR_NOSPACE;
+}
+/**
+ * @brief 在文件末尾追加blks个数据块，优先紧接最后一个extent分配以便合并
+ * 
+ * @param inode 
+ * @param blks 
+ * @return int 
+ */
+int newfs_extend(struct newfs_inode* inode, int blks) {
+    struct newfs_extent* last;
+    struct newfs_extent* extents;
+    int goal, start, len, ret;
+
+    while (blks > 0) {
+        last  = inode->ext_cnt > 0 ? &inode->extents[inode->ext_cnt - 1] : NULL;
+        goal  = last != NULL ? last->start + last->len : newfs_data_goal(inode);
+        start = newfs_bitmap_alloc_run(&newfs_super.bm_data, goal, blks, &len);
+        if (start < 0) {
+            return start;
+        }
+        if (last != NULL && start == goal &&          /* 与最后一个extent相邻且在同一块组，直接延长 */
+            NEWFS_DATA_GROUP(start) == NEWFS_DATA_GROUP(goal - 1)) {
+            last->len += len;
+            newfs_dirty_extent(inode, inode->ext_cnt - 1);
+        }
+        else {
+            if ((ret = newfs_map_reserve(inode, inode->ext_cnt)) != NEWFS_ERROR_NONE) {
+                newfs_bitmap_free_run(&newfs_super.bm_data, start, len);
+                return ret;
+            }
+            if (inode->ext_cnt == inode->ext_cap) {
+                extents = (struct newfs_extent*)realloc(inode->extents, 
+                                        (inode->ext_cap * 2 + 1) * sizeof(struct newfs_extent));
+                if (extents == NULL) {
+                    newfs_bitmap_free_run(&newfs_super.bm_data, start, len);
+                    return -NEWFS_ERROR_NOSPACE;
+                }
+                inode->extents = extents;
+                inode->ext_cap = inode->ext_cap * 2 + 1;
+            }
+            inode->extents[inode->ext_cnt].start = start;
+            inode->extents[inode->ext_cnt].len   = len;
+            newfs_dirty_extent(inode, inode->ext_cnt);
+            inode->ext_cnt++;
+        }
+        inode->blks += len;
+        blks        -= len;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 从文件末尾释放数据块，只保留前blks块
+ * 
+ * @param inode 
+ * @param blks 
+ */
+void newfs_shrink(struct newfs_inode* inode, int blks) {
+    struct newfs_extent* last;
+    int cut;
+
+    while (inode->blks > blks) {
+        last = &inode->extents[inode->ext_cnt - 1];
+        cut  = inode->blks - blks < last->len ? inode->blks - blks : last->len;
+        newfs_bitmap_free_run(&newfs_super.bm_data, last->start + last->len - cut, cut);
+        last->len   -= cut;
+        inode->blks -= cut;
+        if (last->len == 0) {
+            inode->ext_cnt--;
+        }
+        newfs_dirty_extent(inode, inode->ext_cnt > 0 ? inode->ext_cnt - 1 : 0);
+    }
+    newfs_map_trim(inode);
+    newfs_dirty_inode(inode);
+}
+/**
+ * @brief 文件内容读写：[offset, offset + size) 按extent切分为iovec，一次提交，
+ * 相邻的extent由 newfs_driver_rwv 合并为连续设备访问。范围须已分配
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 文件内偏移
+ * @param is_write 
+ * @return int 
+ */
+static int newfs_inode_rw(struct newfs_inode* inode, uint8_t* buf, int size, int offset,
+                          boolean is_write) {
+    struct newfs_iovec* iov;
+    int iovcnt = 0;
+    int lblk   = offset / NEWFS_BLK_SZ();
+    int blk_ofs = offset % NEWFS_BLK_SZ();
+    int done   = 0;
+    int blkno, run, len, ret;
+
+    iov = (struct newfs_iovec*)malloc((inode->ext_cnt + 1) * sizeof(struct newfs_iovec));
+    if (iov == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    while (done < size) {
+        blkno = newfs_bmap(inode, lblk, &run);
+        if (blkno < 0) {
+            free(iov);
+            return -NEWFS_ERROR_IO;
+        }
+        len = NEWFS_BLKS_SZ(run) - blk_ofs;
+        if (len > size - done) {
+            len = size - done;
+        }
+        iov[iovcnt].offset = NEWFS_DATA_OFS(blkno) + blk_ofs;
+        iov[iovcnt].base   = buf + done;
+        iov[iovcnt].size   = len;
+        iovcnt++;
+        done   += len;
+        lblk   += run;
+        blk_ofs = 0;
+    }
+    ret = is_write ? newfs_driver_writev(iov, iovcnt) : newfs_driver_readv(iov, iovcnt);
+    free(iov);
+    return ret;
+}
+/**
+ * @brief 文件内容读写，未分配数据块的文件读写inode中的内联数据
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 文件内偏移
+ * @param is_write 
+ * @return int 
+ */
+static int newfs_file_rw(struct newfs_inode* inode, uint8_t* buf, int size, int offset,
+                         boolean is_write) {
+    if (inode->blks > 0) {
+        return newfs_inode_rw(inode, buf, size, offset, is_write);
+    }
+    if (is_write) {
+        memcpy(inode->inline_data + offset, buf, size);
+        newfs_dirty_inode(inode);                     /* 内联数据随inode回写 */
+    }
+    else {
+        memcpy(buf, inode->inline_data + offset, size);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 保证文件[0, end)有存放位置：不超过NEWFS_INLINE_SZ的文件留在inode内，
+ * 超过时分配数据块，并把已有的内联数据搬到第一块
+ * 
+ * @param inode 
+ * @param end 
+ * @return int 
+ */
+static int newfs_file_reserve(struct newfs_inode* inode, int end) {
+    int blks = NEWFS_ROUND_UP(end, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    int ret;
+
+    if (inode->blks == 0 && end <= NEWFS_INLINE_SZ) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (blks <= inode->blks) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (inode->blks > 0 || inode->size == 0) {
+        return newfs_extend(inode, blks - inode->blks);
+    }
+    if ((ret = newfs_extend(inode, blks)) != NEWFS_ERROR_NONE) {
+        newfs_shrink(inode, 0);
+        return ret;
+    }
+    if ((ret = newfs_inode_rw(inode, inode->inline_data, inode->size, 0, TRUE)) != NEWFS_ERROR_NONE) {
+        newfs_shrink(inode, 0);
+        return ret;
+    }
+    memset(inode->inline_data, 0, NEWFS_INLINE_SZ);
+    newfs_dirty_inode(inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将文件[from, to)清零，用于文件被扩大时
+ * 
+ * @param inode 
+ * @param from 
+ * @param to 
+ * @return int 
+ */
+static int newfs_zero_range(struct newfs_inode* inode, int from, int to) {
+    uint8_t* zero;
+    int      ret;
+
+    if (from >= to) {
+        return NEWFS_ERROR_NONE;
+    }
+    zero = (uint8_t*)calloc(to - from, 1);
+    if (zero == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    ret = newfs_file_rw(inode, zero, to - from, from, TRUE);
+    free(zero);
+    return ret;
+}
+/**
+ * @brief 调整文件大小：变大时分配数据块并将新增部分清零，变小时释放多余的数据块
+ * 
+ * @param inode 
+ * @param size 新大小
+ * @return int 
+ */
+int newfs_file_truncate(struct newfs_inode* inode, int size) {
+    int blks = NEWFS_ROUND_UP(size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    int ret;
+
+    if (size > inode->size) {
+        if ((ret = newfs_file_reserve(inode, size)) != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+        if ((ret = newfs_zero_range(inode, inode->size, size)) != NEWFS_ERROR_NONE) {
+            return ret;
+        }
+    }
+    else if (blks < inode->blks) {
+        newfs_shrink(inode, blks);
+    }
+    inode->size = size;
+    newfs_dirty_inode(inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读文件，内联的小文件不访问设备
+ * 
+ * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 读取的字节数，文件末尾之后返回0
+ */
+int newfs_file_read(struct newfs_inode* inode, uint8_t* buf, int size, int offset) {
+    int ret;
+    if (offset >= inode->size) {
+        return 0;
+    }
+    if (size > inode->size - offset) {
+        size = inode->size - offset;
+    }
+    if ((ret = newfs_file_rw(inode, buf, size, offset, FALSE)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    return size;
+}
+/**
+ * @brief 数据块在磁盘上的内容是否最新：不在块缓存中或缓存中的内容与磁盘一致，且不在未做检查点的事务中
+ * 
+ * @param blkno 数据块号
+ * @return boolean 
+ */
+static boolean newfs_data_is_clean(int blkno) {
+    int blk = NEWFS_DATA_OFS(blkno) / NEWFS_BLK_SZ();
+    struct newfs_buf* buf;
+    boolean is_clean;
+
+    NEWFS_BCACHE_LOCK();
+    buf      = newfs_bcache_lookup(blk);
+    is_clean = !newfs_journal_is_logged(blk) && 
+               (buf == NULL || !(buf->flag & (NEWFS_FLAG_BUF_DIRTY | NEWFS_FLAG_BUF_OCCUPY | NEWFS_FLAG_BUF_LOGGED)));
+    NEWFS_BCACHE_UNLOCK();
+    return is_clean;
+}
+/**
+ * @brief 读文件，结果以fuse_bufvec交给FUSE，调用者持有inode读锁。
+ * 
+ * 磁盘上内容最新的整块不读入内存，只给出它们在设备文件中的位置（磁盘上相连的块合为一段），
+ * 由FUSE直接从设备文件splice给内核；不对齐的首尾、内联数据和块缓存中较新的块读入新申请的内存。
+ * 后端不能splice时整体读入一段对齐的内存。高层接口在锁释放后才回复，其间释放的数据块由
+ * newfs_bitmap_pin 保证不会马上分给别的文件。
+ * 
+ * @param inode 
+ * @param bufp 输出，各段内存由调用者在回复后释放
+ * @param size 
+ * @param offset 
+ * @return int 读取的字节数，文件末尾之后返回0
+ */
+int newfs_file_read_buf(struct newfs_inode* inode, struct fuse_bufvec** bufp, int size, int offset) {
+    struct fuse_bufvec* vec;
+    struct fuse_buf*    seg = NULL;
+    int      fd   = newfs_dev_splice_fd();
+    int      done = 0;
+    int      nseg, blkno, run, blk_ofs, len, ret;
+    size_t   i;
+    boolean  is_fd;
+
+    if (offset >= inode->size) {
+        size = 0;
+    }
+    else if (size > inode->size - offset) {
+        size = inode->size - offset;
+    }
+    nseg = fd < 0 || inode->blks == 0 || size == 0 ? 1 : size / NEWFS_BLK_SZ() + 2;   /* 每块最多一段 */
+    vec  = (struct fuse_bufvec *)malloc(sizeof(struct fuse_bufvec) + (nseg - 1) * sizeof(struct fuse_buf));
+    if (vec == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    *vec = FUSE_BUFVEC_INIT(size);
+    vec->buf[0].pos = offset;                         /* 内存段的pos暂存文件内偏移 */
+    if (nseg > 1) {
+        vec->count = 0;
+    }
+    while (nseg > 1 && done < size) {
+        blkno   = newfs_bmap(inode, (offset + done) / NEWFS_BLK_SZ(), &run);
+        blk_ofs = (offset + done) % NEWFS_BLK_SZ();
+        if (blkno < 0) {
+            free(vec);
+            return blkno;
+        }
+        for (; run > 0 && done < size; run--, blkno++, blk_ofs = 0) {
+            len   = NEWFS_BLK_SZ() - blk_ofs < size - done ? NEWFS_BLK_SZ() - blk_ofs : size - done;
+            is_fd = len == NEWFS_BLK_SZ() && newfs_data_is_clean(blkno);
+            if (seg != NULL && !!(seg->flags & FUSE_BUF_IS_FD) == is_fd &&
+                (!is_fd || seg->pos + (off_t)seg->size == NEWFS_DATA_OFS(blkno))) {
+                seg->size += len;
+            }
+            else {
+                seg        = &vec->buf[vec->count++];
+                seg->size  = len;
+                seg->mem   = NULL;
+                seg->flags = is_fd ? FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK : 0;
+                seg->fd    = is_fd ? fd : -1;
+                seg->pos   = is_fd ? NEWFS_DATA_OFS(blkno) : offset + done;
+            }
+            done += len;
+        }
+    }
+    for (i = 0; i < vec->count; i++) {
+        seg = &vec->buf[i];
+        if (seg->flags & FUSE_BUF_IS_FD) {
+            continue;
+        }
+        if (posix_memalign(&seg->mem, NEWFS_IO_SZ(), seg->size == 0 ? 1 : seg->size) != 0) {
+            seg->mem = NULL;
+            ret      = -NEWFS_ERROR_NOSPACE;
+        }
+        else {
+            ret = newfs_file_rw(inode, seg->mem, seg->size, seg->pos, FALSE);
+        }
+        seg->pos = 0;
+        if (ret != NEWFS_ERROR_NONE) {
+            newfs_free_bufvec(vec);
+            return ret;
+        }
     }
-    memcpy(out_content, temp_content + bias, size);//复制
-    free(temp_content);
-    return NEWFS_ERROR_NONE;
+    *bufp = vec;
+    return size;
 }
 /**
- * @brief 驱动写
+ * @brief 释放 newfs_file_read_buf 返回的fuse_bufvec及其内存段
  * 
- * @param offset 
- * @param in_content 
- * @param size 
- * @return int 
+ * @param vec 
  */
-int newfs_driver_write(int offset, uint8_t *in_content, int size) {
-    int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_BLK_SZ());
-    int      bias           = offset - offset_aligned;
-    int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_BLK_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
-    
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        cur          += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();   
+void newfs_free_bufvec(struct fuse_bufvec* vec) {
+    size_t i;
+    for (i = 0; i < vec->count; i++) {
+        free(vec->buf[i].mem);
     }
-
-    free(temp_content);
-    return NEWFS_ERROR_NONE;
+    free(vec);
 }
 /**
- * @brief 为一个inode分配dentry的bro，采用头插法
+ * @brief 写文件，写到文件末尾之后时先扩大文件，超出内联大小时转为数据块存放
  * 
  * @param inode 
+ * @param buf 
+ * @param size 
+ * @param offset 
+ * @return int 写入的字节数
+ */
+int newfs_file_write(struct newfs_inode* inode, const uint8_t* buf, int size, int offset) {
+    int end  = offset + size;
+    int ret;
+
+    if (offset > inode->size &&                       /* 跳过的部分读出为0 */
+        (ret = newfs_file_truncate(inode, offset)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    if ((ret = newfs_file_reserve(inode, end)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    if ((ret = newfs_file_rw(inode, (uint8_t *)buf, size, offset, TRUE)) != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    if (end > inode->size) {
+        inode->size = end;
+        newfs_dirty_inode(inode);
+    }
+    return size;
+}
+/**
+ * @brief inode分配的起点：文件放在父目录所在的块组；新目录放在inode占用最少的块组，
+ * 使各块组的目录树分散开、每个目录下的文件集中
+ * 
  * @param dentry 
- * @return int 
+ * @return int 期望的inode号，根目录为-1
  */
-int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
-    if (inode->dentrys == NULL) {
-        inode->dentrys = dentry;
+static int newfs_inode_goal(struct newfs_dentry* dentry) {
+    int group;
+
+    if (dentry->parent == NULL || dentry->parent->inode == NULL) {
+        return -1;
     }
-    else {
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
+    group = NEWFS_INO_GROUP(dentry->parent->inode->ino);
+    if (dentry->ftype == NEWFS_DIR) {
+        group = newfs_bitmap_least_used(&newfs_super.bm_inode, group);
     }
-    inode->dir_cnt++;
-    return inode->dir_cnt;
+    return group * newfs_super.ino_per_group;
 }
+/**
+ * @brief 分配inode号。低层接口下跳过内核仍持有lookup计数的号（文件已删除、内核尚未forget），
+ * 否则内核缓存的旧inode会指向新文件；跳过的号在分配完成后放回
+ * 
+ * @param goal 
+ * @return int inode号，没有空闲时返回 -NEWFS_ERROR_NOSPACE
+ */
+static int newfs_alloc_ino(int goal) {
+    int* busy  = NULL;
+    int* grown;
+    int  nbusy = 0;
+    int  ino, i;
 
+    ino = newfs_bitmap_alloc(&newfs_super.bm_inode, goal);
+    while (ino >= 0 && newfs_super.nlookup != NULL &&
+           __atomic_load_n(&newfs_super.nlookup[ino], __ATOMIC_ACQUIRE) > 0) {
+        grown = (int *)realloc(busy, (nbusy + 1) * sizeof(int));
+        if (grown == NULL) {
+            newfs_bitmap_free(&newfs_super.bm_inode, ino);
+            ino = -NEWFS_ERROR_NOSPACE;
+            break;
+        }
+        busy          = grown;
+        busy[nbusy++] = ino;
+        ino = newfs_bitmap_alloc(&newfs_super.bm_inode, -1);   /* 接着上次分配的位置往后找 */
+    }
+    for (i = 0; i < nbusy; i++) {
+        newfs_bitmap_free(&newfs_super.bm_inode, busy[i]);
+    }
+    free(busy);
+    return ino;
+}
 /**
  * @brief 分配一个inode，占用位图
  * 
  * @param dentry 该dentry指向分配的inode
- * @return NEWfs_inode
+ * @return NEWfs_inode 空间不足返回NULL
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     struct newfs_inode* inode;
-    int byte_cursor; 
-    int bit_cursor; 
-    int ino_cursor   = 0;
-    boolean is_find_free_entry = FALSE;
-    boolean is_findall_data_blks = FALSE;
-    int data_blk_cnt = 0;
-    int bp_cursor   = 0;
-
-    // 从索引节点位图中取空闲inode
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        // 限制了一个块中inode位图只占8位
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((newfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                newfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor); // inode位图占位
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry) {
-            break;
-        }
+    int ino;
+
+    // 从索引节点位图中取空闲inode，优先放在父目录所在的块组
+    ino = newfs_alloc_ino(newfs_inode_goal(dentry));
+    if (ino < 0) {
+        return NULL;
     }
-    //无空闲inode
-    if (!is_find_free_entry || ino_cursor == newfs_super.max_ino)
-        return -NEWFS_ERROR_NOSPACE;
 
     // 先分配一个内存 inode
-    inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
-    inode->ino  = ino_cursor; 
-    inode->size = 0;
-
-    // 再从数据位图中取空闲，要取出的数据块数量为每个inode中指向对应数据块的指针的数量
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks); 
-         byte_cursor++)
-    {   
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前data_block位置空闲 */
-                newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor); // 数据块位图占位
-                // 将找到的数据块号记入inode中，并判断是否找完inode对应的所有的数据块
-                if(data_blk_cnt >= (NEWFS_DATA_PER_FILE -1)){
-                    is_findall_data_blks = TRUE;
-                    break;
-                } else{
-                    inode->block_pointer[data_blk_cnt] = bp_cursor;
-                    data_blk_cnt++;
-                }
-            }
-            bp_cursor++;
-        }
-
-        // printf("map_data: %d", &newfs_super.map_data[byte_cursor]);
-
-        if (is_findall_data_blks) {
-            break;
-        }
+    inode = (struct newfs_inode*)newfs_slab_alloc(&newfs_super.slab_inode);
+    if (inode == NULL) {
+        newfs_bitmap_free(&newfs_super.bm_inode, ino);
+        return NULL;
     }
-
-    if (!is_findall_data_blks || bp_cursor == newfs_super.max_data)
-        return -NEWFS_ERROR_NOSPACE;
-
+    inode->ino  = ino; 
+    inode->size = 0;
+    inode->ext_ind  = NEWFS_BLK_NONE;
+    inode->ext_dind = NEWFS_BLK_NONE;
+    inode->ext_dirty_from = INT32_MAX;
+    pthread_rwlock_init(&inode->lock, NULL);
+    // 数据块在写入或目录增长时才分配
 
     dentry->inode = inode;
     dentry->ino   = inode->ino;
     
     inode->dentry = dentry;
+    newfs_super.ino_dentry[ino] = dentry;
     
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
-    
+    newfs_dirty_inode(inode);
+
+    return inode;
+}
+/**
+ * @brief 删除一个文件或空目录：从父目录摘除，归还inode与数据块
+ * 
+ * @param dentry 待删除的目录项，其inode须已读入
+ * @return int 
+ */
+int newfs_remove_dentry(struct newfs_dentry* dentry) {
+    struct newfs_inode* parent = dentry->parent->inode;
+
+    if (newfs_dentry_inode(dentry) == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (NEWFS_IS_DIR(dentry->inode) && dentry->inode->dir_cnt != 0) {
+        return -NEWFS_ERROR_NOTEMPTY;
+    }
+    newfs_drop_dentry(parent, dentry);
+    newfs_dir_trim(parent);
+    newfs_free_inode(dentry->inode);
+    free_dentry(dentry);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 在目录parent下新建文件或目录，调用者已确认没有同名项
+ * 
+ * @param parent 父目录dentry，其inode须已读入
+ * @param fname 文件名
+ * @param ftype 
+ * @return struct newfs_dentry* 空间不足返回NULL
+ */
+struct newfs_dentry* newfs_create_dentry(struct newfs_dentry* parent, const char* fname, FILE_TYPE ftype) {
+    struct newfs_dentry* dentry;
+
+    if (newfs_dir_grow(parent->inode, NEWFS_DENTRY_REC_LEN(strnlen(fname, MAX_NAME_LEN - 1))) != NEWFS_ERROR_NONE) {
+        return NULL;
+    }
+    dentry = new_dentry(fname, ftype);
+    if (dentry == NULL) {
+        return NULL;
+    }
+    dentry->parent = parent;
+    if (newfs_alloc_inode(dentry) == NULL) {
+        free_dentry(dentry);
+        return NULL;
+    }
+    newfs_alloc_dentry(parent->inode, dentry);
+    newfs_dirty_dentry(parent->inode, dentry);
+    return dentry;
+}
+/**
+ * @brief 将dentry移动到目录to_parent下并改名为fname。同名的目标让出它的记录空间给dentry，
+ * 移动完成后才释放；会失败的步骤都在修改目录之前，失败时源和目标都保持原样
+ * 
+ * @param dentry 
+ * @param to_parent 新的父目录dentry，其inode须已读入
+ * @param fname 新名字
+ * @param target to_parent下名为fname的目录项，被替换；没有时为NULL
+ * @return int 
+ */
+int newfs_move_dentry(struct newfs_dentry* dentry, struct newfs_dentry* to_parent, const char* fname,
+                      struct newfs_dentry* target) {
+    struct newfs_inode* from = dentry->parent->inode;
+    char* name;
+    int   ret;
 
-    if (NEWFS_IS_FILE(inode)) {
-        int bp_cnt = 0;
-        for(bp_cnt = 0; bp_cnt < NEWFS_DATA_PER_FILE; bp_cnt++){
-            inode->block_pointer[bp_cnt] = (uint8_t *)malloc(NEWFS_BLK_SZ());
+    if (target != NULL) {
+        if (newfs_dentry_inode(target) == NULL) {
+            return -NEWFS_ERROR_IO;
         }
+        if (NEWFS_IS_DIR(target->inode) && target->inode->dir_cnt != 0) {
+            return -NEWFS_ERROR_NOTEMPTY;
+        }
+    }
+    if ((name = newfs_name_dup(fname)) == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    /* 先确保新目录有空位，之后的加入不会失败；同名目标的记录与新记录等长，摘下它即空出位置 */
+    ret = target != NULL ? newfs_slot_reserve(to_parent->inode)
+                         : newfs_dir_grow(to_parent->inode, NEWFS_DENTRY_REC_LEN(strlen(name)));
+    if (ret != NEWFS_ERROR_NONE) {
+        newfs_name_free(name);
+        return ret;
     }
+    if (target != NULL) {
+        newfs_drop_dentry(to_parent->inode, target);
+    }
+    newfs_drop_dentry(from, dentry);
+    newfs_name_free(dentry->name);
+    dentry->name   = name;
+    dentry->parent = to_parent;
+    newfs_alloc_dentry(to_parent->inode, dentry);
+    newfs_dirty_dentry(to_parent->inode, dentry);
+    newfs_dir_trim(from);                             /* 原目录空出的块在加入后才归还 */
+    if (target != NULL) {
+        newfs_free_inode(target->inode);
+        free_dentry(target);
+    }
+    return NEWFS_ERROR_NONE;
+}
 
-    return inode;
+/**
+ * @brief 将一个目录块中的全部目录项依次紧排为变长记录后写入块缓存
+ * 
+ * @param inode 目录inode
+ * @param blk_cnt 目录的第几个数据块
+ * @return int 
+ */
+static int newfs_sync_dir_blk(struct newfs_inode * inode, int blk_cnt) {
+    struct newfs_dentry*   dentry_cursor = inode->dentrys;
+    struct newfs_dentry_d* dentry_d;
+    struct newfs_buf*      buf;
+    int                    blkno;
+    int                    ofs = 0;
+    int                    name_len;
+
+    blkno = newfs_bmap(inode, blk_cnt, NULL);
+    if (blkno < 0) {                                        /* 目录块未分配，不能写到数据区之外 */
+        return blkno;
+    }
+    blkno = NEWFS_DATA_OFS(blkno) / NEWFS_BLK_SZ();
+    NEWFS_BCACHE_LOCK();
+    buf   = newfs_bcache_get(blkno, FALSE);                 /* 整块重写，无需读入 */
+    if (buf == NULL) {
+        NEWFS_BCACHE_UNLOCK();
+        return -NEWFS_ERROR_IO;
+    }
+    memset(buf->data, 0, NEWFS_BLK_SZ());
+    while (dentry_cursor != NULL)
+    {
+        if (dentry_cursor->blk == blk_cnt) {
+            name_len = strlen(dentry_cursor->name);
+            dentry_d = (struct newfs_dentry_d *)(buf->data + ofs);
+            dentry_d->ino      = dentry_cursor->ino;
+            dentry_d->hash     = dentry_cursor->hash;
+            dentry_d->rec_len  = NEWFS_DENTRY_REC_LEN(name_len);
+            dentry_d->name_len = name_len;
+            dentry_d->ftype    = dentry_cursor->ftype;
+            memcpy(dentry_d->fname, dentry_cursor->name, name_len);
+            ofs += dentry_d->rec_len;
+        }
+        dentry_cursor = dentry_cursor->brother;
+    }
+    newfs_bcache_mark_dirty(buf);
+    NEWFS_BCACHE_UNLOCK();
+    return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 将一个脏inode及其变化过的目录块刷回，不递归子节点，子节点各自在脏链表上
  * 
  * @param inode 
  * @return int 
  */
 int newfs_sync_inode(struct newfs_inode * inode) {
     struct newfs_inode_d  inode_d;
-    struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
     int ino             = inode->ino;
-    inode_d.ino         = ino;
-    inode_d.size        = inode->size;
-    inode_d.ftype       = inode->dentry->ftype;
-    inode_d.dir_cnt     = inode->dir_cnt;
-    // 将数据块指针的值刷回磁盘
-    for(int blk_cnt = 0; blk_cnt < NEWFS_DATA_PER_FILE; blk_cnt++)
-        inode_d.block_pointer[blk_cnt] = inode->block_pointer[blk_cnt]; 
-
-    int offset, offset_pmax;
-    
-    // 先将当前inode刷回磁盘
-    if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
-                     sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
-        NEWFS_DBG("[%s] io error\n", __func__);
-        return -NEWFS_ERROR_IO;
+    int blk_cnt;
+    int i;
+
+    if (inode->flag & NEWFS_FLAG_INODE_DIRTY) {
+        memset(&inode_d, 0, sizeof(struct newfs_inode_d));
+        inode_d.ino         = ino;
+        inode_d.size        = inode->size;
+        inode_d.link        = 1;
+        inode_d.ftype       = inode->dentry->ftype;
+        inode_d.dir_cnt     = inode->dir_cnt;
+        // 将extent刷回磁盘
+        inode_d.ext_cnt     = inode->ext_cnt;
+        for (i = 0; i < inode->ext_cnt && i < NEWFS_EXTENT_DIRECT; i++)
+            inode_d.extents[i] = inode->extents[i];
+        inode_d.ext_ind     = inode->ext_ind;
+        inode_d.ext_dind    = inode->ext_dind;
+        memcpy(inode_d.inline_data, inode->inline_data, NEWFS_INLINE_SZ);
+        if (newfs_sync_extents(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+
+        if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
+                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+        inode->flag &= ~NEWFS_FLAG_INODE_DIRTY;
     }
-                                                      /* Cycle 1: 写 INODE */
-                                                      /* Cycle 2: 写 数据 */
-    if (NEWFS_IS_DIR(inode)) {      
-        int blk_cnt = 0;                    
-        dentry_cursor = inode->dentrys;
-
-        while(blk_cnt < NEWFS_DATA_PER_FILE){
-            offset = NEWFS_DATA_OFS(inode->block_pointer[blk_cnt]);
-            offset_pmax = NEWFS_DATA_OFS(inode->block_pointer[blk_cnt] + 1);
-            while (dentry_cursor != NULL)
-            {
-                memcpy(dentry_d.fname, dentry_cursor->name, MAX_FILE_NAME);
-                dentry_d.ftype = dentry_cursor->ftype;
-                dentry_d.ino = dentry_cursor->ino;
-                //写回磁盘
-                if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                    sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return -NEWFS_ERROR_IO;                     
-                }
-                // 将子目录项指向的inode递归刷回磁盘
-                if (dentry_cursor->inode != NULL) {
-                    newfs_sync_inode(dentry_cursor->inode);
-                }
-                // 指向下一个目录项继续刷回
-                dentry_cursor = dentry_cursor->brother;
-                if(offset + sizeof(struct newfs_dentry_d) > offset_pmax){
-                    break;
-                }
-                offset += sizeof(struct newfs_dentry_d);
-            }
-            blk_cnt++;
+
+    /* 已释放的目录块无需回写，只处理现存的块 */
+    for (blk_cnt = 0; inode->dirty_blks != 0 && blk_cnt < inode->blks; blk_cnt++) {
+        if (!(inode->dirty_blks & NEWFS_DIRTY_BLK_MASK(blk_cnt))) {
+            continue;
         }
-    } else if (NEWFS_IS_FILE(inode)) { // 对于文件类型的文件，直接将数据刷回磁盘
-        // 将指针数组对应的数据块一一刷回
-        for(int blk_cnt = 0; blk_cnt < NEWFS_DATA_PER_FILE; blk_cnt++){
-            if (newfs_driver_write(NEWFS_DATA_OFS(inode->block_pointer[blk_cnt]), 
-                    (uint8_t *)&inode->block_pointer[blk_cnt], NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
+        if (newfs_sync_dir_blk(inode, blk_cnt) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
         }
     }
+    inode->dirty_blks = 0;
     return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief newfs_read_inode失败时的统一清理：释放已挂入的子目录项、inode的变长数组和inode本身，
+ * 并清除inode号表中的登记
+ * 
+ * @param inode 读入到一半的inode
+ * @return struct newfs_inode* 总是NULL
+ */
+static struct newfs_inode* newfs_read_inode_fail(struct newfs_inode* inode) {
+    struct newfs_dentry* sub_dentry;
+
+    while ((sub_dentry = inode->dentrys) != NULL) {
+        inode->dentrys = sub_dentry->brother;
+        free_dentry(sub_dentry);
+    }
+    if (inode->ino < (uint32_t)newfs_super.max_ino) {
+        newfs_super.ino_dentry[inode->ino] = NULL;
+    }
+    pthread_rwlock_destroy(&inode->lock);
+    free(inode->extents);
+    free(inode->dind_blks);
+    free(inode->index);
+    free(inode->dir_free);
+    free(inode->slots);
+    newfs_slab_free(&newfs_super.slab_inode, inode);
+    return NULL;
+}
 /**
  * @brief 该函数实现的功能是读取dentry指向的编号为ino的索引节点
  * 
@@ -290,53 +1550,117 @@ int newfs_sync_inode(struct newfs_inode * inode) {
  * @return struct newfs_inode* 
  */
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
-    struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+    struct newfs_inode* inode;
     struct newfs_inode_d inode_d;       // 介质inode(驱动读取)
     struct newfs_dentry* sub_dentry;    // 子目录项的中间变量
-    struct newfs_dentry_d dentry_d;     // 介质dentry(驱动读取)
+    struct newfs_dentry_d* dentry_d;    // 介质dentry(指向缓存块)
+    struct newfs_buf*     buf;
+    char   fname[MAX_NAME_LEN];
     int    blk_cnt = 0;
-    int    dir_cnt = 0;
+    int    ofs;
+    int    blkno;
+    int    i;
 
     if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, 
                         sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
         NEWFS_DBG("[%s] io error\n", __func__);
         return NULL;
     }
+    inode = (struct newfs_inode*)newfs_slab_alloc(&newfs_super.slab_inode);
+    if (inode == NULL) {
+        return NULL;
+    }
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    for(blk_cnt = 0; blk_cnt < NEWFS_DATA_PER_FILE; blk_cnt++)
-        inode->block_pointer[blk_cnt] = inode_d.block_pointer[blk_cnt];
+    pthread_rwlock_init(&inode->lock, NULL);
+    if (inode->ino < (uint32_t)newfs_super.max_ino) {
+        newfs_super.ino_dentry[inode->ino] = dentry;
+    }
+    inode->ext_cap = inode_d.ext_cnt > NEWFS_EXTENT_DIRECT ? inode_d.ext_cnt : NEWFS_EXTENT_DIRECT;
+    inode->extents = (struct newfs_extent*)malloc(inode->ext_cap * sizeof(struct newfs_extent));
+    if (inode->extents == NULL) {
+        return newfs_read_inode_fail(inode);
+    }
+    inode->ext_cnt = inode_d.ext_cnt;
+    inode->ext_ind  = inode_d.ext_ind;
+    inode->ext_dind = inode_d.ext_dind;
+    inode->ext_dirty_from = INT32_MAX;
+    memcpy(inode->inline_data, inode_d.inline_data, NEWFS_INLINE_SZ);
+    for (i = 0; i < inode_d.ext_cnt && i < NEWFS_EXTENT_DIRECT; i++) {
+        inode->extents[i] = inode_d.extents[i];
+    }
+    if (newfs_load_extents(inode) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        return newfs_read_inode_fail(inode);
+    }
+    for (i = 0; i < inode->ext_cnt; i++) {
+        inode->blks += inode->extents[i].len;
+    }
     
-   
+    /* 每个目录块只读一次，从缓存块中依次解出其中的变长记录，读出的顺序即槽位 */
     if (NEWFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;//目录项数目
-        for (int i = 0; i < dir_cnt; i++)
+        inode->dir_free = (int *)malloc((inode->blks > 0 ? inode->blks : 1) * sizeof(int));
+        if (inode->dir_free == NULL) {
+            return newfs_read_inode_fail(inode);
+        }
+        NEWFS_BCACHE_LOCK();
+        for (blk_cnt = 0; blk_cnt < inode->blks; blk_cnt++)
         {
-            if (newfs_driver_read(NEWFS_DATA_OFS(ino) + i * sizeof(struct newfs_dentry_d), 
-                                (uint8_t *)&dentry_d, 
-                                sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
+            blkno = newfs_bmap(inode, blk_cnt, NULL);
+            buf   = blkno < 0 ? NULL : newfs_bcache_get(NEWFS_DATA_OFS(blkno) / NEWFS_BLK_SZ(), TRUE);
+            if (buf == NULL) {
+                NEWFS_BCACHE_UNLOCK();
                 NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
+                return newfs_read_inode_fail(inode);
             }
-            sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino    = dentry_d.ino; 
-            newfs_alloc_dentry(inode, sub_dentry);
-        }
-    }
-    else if (NEWFS_IS_FILE(inode)) {
-        for(blk_cnt = 0; blk_cnt < NEWFS_DATA_PER_FILE; blk_cnt++){
-            inode->block_pointer[blk_cnt] = (uint8_t *)malloc(NEWFS_BLK_SZ()); // 只分配一个块
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->block_pointer[blk_cnt]), inode->block_pointer[blk_cnt], 
-                                NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
+            for (ofs = 0; ofs + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLK_SZ(); ofs += dentry_d->rec_len) {
+                dentry_d = (struct newfs_dentry_d *)(buf->data + ofs);
+                if (dentry_d->rec_len == 0 || ofs + dentry_d->rec_len > NEWFS_BLK_SZ() ||
+                    dentry_d->name_len >= MAX_NAME_LEN) {
+                    break;                                  /* 块内记录到此为止 */
+                }
+                memcpy(fname, dentry_d->fname, dentry_d->name_len);
+                fname[dentry_d->name_len] = '\0';
+                sub_dentry = newfs_slot_reserve(inode) == NEWFS_ERROR_NONE ? new_dentry(fname, dentry_d->ftype) : NULL;
+                if (sub_dentry == NULL) {
+                    NEWFS_BCACHE_UNLOCK();
+                    return newfs_read_inode_fail(inode);
+                }
+                sub_dentry->parent = inode->dentry;
+                sub_dentry->ino    = dentry_d->ino; 
+                sub_dentry->hash   = dentry_d->hash;
+                sub_dentry->blk    = blk_cnt;
+                newfs_link_dentry(inode, sub_dentry);
             }
+            inode->dir_free[blk_cnt] = NEWFS_BLK_SZ() - ofs;
         }
+        NEWFS_BCACHE_UNLOCK();
+    }
+    return inode;
+}
+/**
+ * @brief 取得dentry指向的inode，尚未读入时读入。持命名空间读锁的线程可能同时查找同一路径，
+ * 由load_lock保证只读入一次，读入完成后才对其他线程可见
+ * 
+ * @param dentry 
+ * @return struct newfs_inode* 读入失败返回NULL
+ */
+struct newfs_inode* newfs_dentry_inode(struct newfs_dentry* dentry) {
+    struct newfs_inode* inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+
+    if (inode != NULL) {
+        return inode;
+    }
+    pthread_mutex_lock(&newfs_super.load_lock);
+    inode = dentry->inode;
+    if (inode == NULL) {
+        inode = newfs_read_inode(dentry, dentry->ino);
+        __atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&newfs_super.load_lock);
     return inode;
 }
 /**
@@ -359,6 +1683,18 @@ struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
     }
     return NULL;
 }
+/**
+ * @brief 按槽位顺序取出目录的全部目录项，readdir以“槽位+1”作为偏移，从任意偏移续读时直接下标访问。
+ * 返回目录自身维护的数组，不复制，调用者持有命名空间锁期间有效
+ * 
+ * @param inode 目录inode
+ * @param slots 返回槽位数组，下标即槽位，空槽为NULL
+ * @return int 槽位数（含空槽）
+ */
+int newfs_dir_slots(struct newfs_inode* inode, struct newfs_dentry*** slots) {
+    *slots = inode->slots;
+    return inode->slot_cnt;
+}
 /**
  * @brief 
  * path: /qwe/ad  total_lvl = 2,
@@ -382,7 +1718,15 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     int   lvl = 0;
     boolean is_hit;
     char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    char* path_cpy;
+
+    dentry_ret = newfs_dcache_lookup(path, is_find);  /* 路径缓存，一次哈希探测 */
+    if (dentry_ret != NULL) {
+        *is_root = *is_find && dentry_ret == newfs_super.root_dentry;
+        return dentry_ret;
+    }
+
+    path_cpy = (char*)malloc(strlen(path) + 1);
     *is_root = FALSE;
     strcpy(path_cpy, path);//复制地址
 
@@ -396,30 +1740,18 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     while (fname)
     {
         lvl++;
-        if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
-        }
+        inode = newfs_dentry_inode(dentry_cursor);   /* Cache机制 */
 
-        inode = dentry_cursor->inode;
-
-        if (NEWFS_IS_FILE(inode) && lvl < total_lvl) {
+        if (NEWFS_IS_FILE(inode)) {                   /* 普通文件下不会再有目录项 */
             NEWFS_DBG("[%s] not a dir\n", __func__);
+            *is_find = FALSE;
             dentry_ret = inode->dentry;
             break;
         }
 
         if (NEWFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->name, fname, strlen(fname)) == 0) {//比较
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;     // 遍历子目录
-            }
+            dentry_cursor = newfs_index_find(inode, fname);   /* 哈希索引，每层O(1) */
+            is_hit        = dentry_cursor != NULL;
             
             if (!is_hit) {
                 *is_find = FALSE;
@@ -437,17 +1769,18 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
         fname = strtok(NULL, "/"); 
     }
 
-    if (dentry_ret->inode == NULL) {
-        dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
-    }
-    
+    newfs_dentry_inode(dentry_ret);
+
+    free(path_cpy);
+    newfs_dcache_add(path, dentry_ret, *is_find);
     return dentry_ret;
 }
 /**
  * @brief 挂载sfs, Layout 如下
  * 
  * Layout
- * | Super | Inode Map| Data Map | Data |
+ * | Super | Inode Map | Data Map | Inode Table | Data | Inode Map | Data Map | Inode Table | Data | ...
+ * 超级块之后是若干块组，见 newfs_layout.c
  * 
  * BLK_SZ = 2 * IO_SZ
  * 
@@ -459,33 +1792,46 @@ int newfs_mount(struct custom_options options){
     int                     ret = NEWFS_ERROR_NONE;
     int                     driver_fd;
     struct newfs_super_d    newfs_super_d; 
+    struct newfs_super_d    journal_d;
     struct newfs_dentry*    root_dentry;
     struct newfs_inode*     root_inode;
 
-    int                     inode_num ;
-    int                     map_inode_blks;
-    int                     data_num;
-    int                     map_data_blks;
-
-    int                     super_blks;
     boolean                 is_init = FALSE;
+    boolean                 is_lazy;
+    int                     nbufs;
+    struct timespec         t_start, t_end;
 
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
     newfs_super.is_mounted = FALSE;
 
-    // driver_fd = open(options.device, O_RDWR);
-     driver_fd = ddriver_open(options.device);
+    newfs_super.dev = newfs_dev_lookup(options.backend);
+    if (newfs_super.dev == NULL) {
+        NEWFS_DBG("[%s] unknown backend %s\n", __func__, options.backend);
+        return -NEWFS_ERROR_INVAL;
+    }
+    driver_fd = newfs_super.dev->open(options.device, options.direct, options.uring_depth);
 
     if (driver_fd < 0) {
         return driver_fd;
     }
 
     newfs_super.fd = driver_fd;
-    ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &newfs_super.sz_disk); //磁盘大小
-    ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);  //IO单位大小
+    newfs_super.sz_disk = newfs_super.dev->size(NEWFS_DRIVER());      //磁盘大小
+    newfs_super.sz_io   = newfs_super.dev->io_size(NEWFS_DRIVER());   //IO单位大小
 
     // 数据块大小为两个IO单位（1024KB）
     newfs_super.sz_blk = 2 * newfs_super.sz_io;
-    
+
+    nbufs = options.cache_blks > 0 ? options.cache_blks : NEWFS_BCACHE_BLKS;
+    if (nbufs < 4 * (options.ra_kb * 1024 / newfs_super.sz_blk)) {  /* 同步和异步两个预读窗口合计不超过缓存的一半 */
+        nbufs = 4 * (options.ra_kb * 1024 / newfs_super.sz_blk);
+        NEWFS_DBG("[%s] cache enlarged to %d blocks for ra_kb %d\n", __func__, nbufs, options.ra_kb);
+    }
+    if (newfs_bcache_init(nbufs) != NEWFS_ERROR_NONE ||
+        newfs_dcache_init() != NEWFS_ERROR_NONE ||
+        newfs_slabs_init() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
 
     root_dentry = new_dentry("/", NEWFS_DIR);
 
@@ -494,121 +1840,279 @@ int newfs_mount(struct custom_options options){
                         sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }   
+    /* 先重放日志，超级块本身也可能只在日志中：就地格式化后尚未做检查点时原位置还没有超级块，按默认布局找到日志区 */
+    journal_d = newfs_super_d;
+    if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM &&
+        newfs_layout_calc(newfs_super.sz_disk, NEWFS_BLK_SZ(), NEWFS_INODE_RATIO,
+                          NEWFS_JOURNAL_AUTO, &journal_d) != NEWFS_ERROR_NONE) {
+        journal_d.journal_blks = 0;
+    }
+    if ((ret = newfs_journal_mount(&journal_d)) < 0) {
+        return ret;
+    }
+    if (ret > 0 && newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d),
+                                     sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    ret = NEWFS_ERROR_NONE;
 
                                                          /* 读取super */
-    if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM) {       /* 幻数无 */
-
-                                    
-        super_blks = NEWFS_SUPER_BLKS;
-        map_inode_blks = NEWFS_MAP_INODE_BLKS;
-        map_data_blks = NEWFS_MAP_DATA_BLKS;
-        inode_num  = NEWFS_INODE_NUM;
-        data_num = NEWFS_DATA_NUM;
-
-                                                      /* 布局layout */
-        newfs_super.max_ino = inode_num;
-        newfs_super.max_data = data_num; 
-
-        // inode位图和数据位图偏移
-        newfs_super_d.map_inode_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
-        newfs_super_d.map_data_offset = newfs_super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
-
-        // inode和数据块
-        newfs_super_d.inode_offset = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(NEWFS_ROUND_UP(
-                                    inode_num * NEWFS_INODE_SZ(), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ());
-
-        // inode位图、数据位图所占块大小
-        newfs_super_d.map_inode_blks  = map_inode_blks;
-        newfs_super_d.map_data_blks = map_data_blks;
-
-        newfs_super_d.magic_num = NEWFS_MAGIC_NUM;
-        newfs_super_d.sz_usage    = 0;
-        // NEWFS_DBG("inode map blocks: %d\n", map_inode_blks);
+    if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM) {       /* 幻数无，按默认inode比例就地格式化，布局与mkfs.newfs相同 */
+        if ((ret = newfs_layout_calc(newfs_super.sz_disk, NEWFS_BLK_SZ(), NEWFS_INODE_RATIO,
+                                     NEWFS_JOURNAL_AUTO, &newfs_super_d)) != NEWFS_ERROR_NONE) {
+            return ret;
+        }
         is_init = TRUE;
     }
+    else if (newfs_super_d.max_ino == 0) {            /* 旧版本超级块未记录容量，使用默认布局 */
+        newfs_super_d.max_ino  = NEWFS_INODE_NUM;
+        newfs_super_d.max_data = NEWFS_DATA_NUM;
+    }
+    if (newfs_super_d.groups == 0) {                  /* 未分组的旧布局视为只有一个块组 */
+        newfs_super_d.groups         = 1;
+        newfs_super_d.ino_per_group  = newfs_super_d.max_ino;
+        newfs_super_d.data_per_group = newfs_super_d.max_data;
+        newfs_super_d.group_blks     = 0;
+    }
+    is_lazy = options.lazy_mount && !is_init;         /* 新格式化的设备无需延迟 */
     newfs_super.sz_usage   = newfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
+    newfs_super.max_ino    = newfs_super_d.max_ino;
+    newfs_super.max_data   = newfs_super_d.max_data;
     
-    newfs_super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
+    newfs_super.groups         = newfs_super_d.groups;
+    newfs_super.ino_per_group  = newfs_super_d.ino_per_group;
+    newfs_super.data_per_group = newfs_super_d.data_per_group;
+    newfs_super.group_sz       = NEWFS_BLKS_SZ(newfs_super_d.group_blks);
+
+    // 各块组的位图在内存中依次相连，按64位字对齐
+    newfs_super.map_inode = (uint8_t *)calloc(NEWFS_ROUND_UP((newfs_super.groups * newfs_super.ino_per_group), 64) 
+                                              / UINT8_BITS, sizeof(uint8_t));
     newfs_super.map_inode_blks = newfs_super_d.map_inode_blks;
     newfs_super.map_inode_offset = newfs_super_d.map_inode_offset;
 
     //数据块位图的in-memory结构
-    newfs_super.map_data = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
+    newfs_super.map_data = (uint8_t *)calloc(NEWFS_ROUND_UP((newfs_super.groups * newfs_super.data_per_group), 64) 
+                                             / UINT8_BITS, sizeof(uint8_t));
     newfs_super.map_data_blks = newfs_super_d.map_data_blks;
     newfs_super.map_data_offset = newfs_super_d.map_data_offset;
 
+    newfs_super.inode_offset = newfs_super_d.inode_offset;
     newfs_super.data_offset = newfs_super_d.data_offset;
 
-    // 读取索引节点位图
-    if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-                        NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    // 位图按块组记录是否需要回写
+    newfs_super.map_inode_dirty = (uint8_t *)calloc(newfs_super.groups, sizeof(uint8_t));
+    newfs_super.map_data_dirty  = (uint8_t *)calloc(newfs_super.groups, sizeof(uint8_t));
+    newfs_super.dirty_inodes    = NULL;
+    newfs_super.is_super_dirty  = is_init;
+    newfs_super.ino_dentry      = (struct newfs_dentry **)calloc(newfs_super.max_ino, 
+                                                                 sizeof(struct newfs_dentry *));
+    newfs_super.nlookup         = options.lowlevel ? (unsigned long *)calloc(newfs_super.max_ino, 
+                                                                             sizeof(unsigned long)) : NULL;
+    if (newfs_super.ino_dentry == NULL || (options.lowlevel && newfs_super.nlookup == NULL) ||
+        newfs_super.map_inode == NULL || newfs_super.map_data == NULL ||
+        newfs_super.map_inode_dirty == NULL || newfs_super.map_data_dirty == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
     }
 
-    // 读取数据块位图
-    if (newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
-                        NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    if (newfs_bitmap_init(&newfs_super.bm_inode, newfs_super.map_inode, newfs_super.max_ino,
+                          newfs_super.ino_per_group, newfs_super.map_inode_dirty,
+                          newfs_super.map_inode_offset, newfs_super.group_sz) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_init(&newfs_super.bm_data, newfs_super.map_data, newfs_super.max_data,
+                          newfs_super.data_per_group, newfs_super.map_data_dirty,
+                          newfs_super.map_data_offset, newfs_super.group_sz) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    if (!options.no_buf_io && !options.lowlevel && newfs_dev_splice_fd() >= 0 &&   /* 见 newfs_file_read_buf */
+        newfs_bitmap_pin(&newfs_super.bm_data) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (is_init) {                                    /* 新建的位图全部清零，整体回写 */
+        ret = newfs_bitmap_format(&newfs_super.bm_inode);
+        if (ret == NEWFS_ERROR_NONE) {
+            ret = newfs_bitmap_format(&newfs_super.bm_data);
+        }
+    }
+    else if (!is_lazy) {                              /* 延迟挂载时位图在第一次分配或释放时读入 */
+        ret = newfs_bitmap_load(&newfs_super.bm_inode);
+        if (ret == NEWFS_ERROR_NONE) {
+            ret = newfs_bitmap_load(&newfs_super.bm_data);
+        }
+    }
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
     }
 
-    if (is_init) {                                    /* 分配根节点 */
+    if (is_init) {                                    /* 分配根节点，留在脏链表上等待回写 */
         root_inode = newfs_alloc_inode(root_dentry);
-        newfs_sync_inode(root_inode);
     }
-    
-    root_inode            = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+    else if (is_lazy) {                               /* 根目录由第一次查找经 newfs_dentry_inode 读入 */
+        root_dentry->ino = NEWFS_ROOT_INO;
+        newfs_super.ino_dentry[NEWFS_ROOT_INO] = root_dentry;
+        root_inode = NULL;
+    }
+    else {
+        root_inode = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+    }
     root_dentry->inode    = root_inode;
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted  = TRUE;
 
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    newfs_super.mount_us = (t_end.tv_sec - t_start.tv_sec) * 1000000L +
+                           (t_end.tv_nsec - t_start.tv_nsec) / 1000;
+    NEWFS_DBG("[%s] mounted in %ld us%s\n", __func__, newfs_super.mount_us, is_lazy ? " (lazy)" : "");
+
     return ret;
 }
 
 /**
- * @brief 
+ * @brief 将所有脏元数据（inode、目录项、位图、超级块）写入块缓存，
+ * 只写脏链表上的inode及其变化过的目录块、被修改过的位图块，调用者持有命名空间写锁，
+ * 启用日志时在 newfs_journal_begin 之后调用，全部元数据随后作为一个事务提交
  * 
  * @return int 
  */
-int newfs_umount() {
+static int newfs_sync_meta() {
     struct newfs_super_d  newfs_super_d; 
+    struct newfs_inode*   inode;
 
-    if (!newfs_super.is_mounted) {
-        return NEWFS_ERROR_NONE;
+    if (newfs_bitmap_sync(&newfs_super.bm_inode) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_sync(&newfs_super.bm_data) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
     }
 
-    newfs_sync_inode(newfs_super.root_dentry->inode);     /* 从根节点向下刷写节点 */
-                                                
-    newfs_super_d.magic_num           = NEWFS_MAGIC_NUM;
-    newfs_super_d.sz_usage            = newfs_super.sz_usage;
+    while (newfs_super.dirty_inodes != NULL) {
+        inode = newfs_super.dirty_inodes;
+        if (newfs_sync_inode(inode) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_super.dirty_inodes = inode->dirty_next;
+        inode->dirty_next = NULL;
+        inode->flag &= ~NEWFS_FLAG_INODE_LISTED;
+    }
 
-    newfs_super_d.map_inode_blks      = newfs_super.map_inode_blks;
-    newfs_super_d.map_inode_offset    = newfs_super.map_inode_offset;
-    newfs_super_d.map_data_blks       = newfs_super.map_data_blks;
-    newfs_super_d.map_data_offset     = newfs_super.map_data_offset;
+    if (newfs_super.is_super_dirty) {
+        memset(&newfs_super_d, 0, sizeof(struct newfs_super_d));
+        newfs_super_d.magic_num           = NEWFS_MAGIC_NUM;
+        newfs_super_d.sz_usage            = newfs_super.sz_usage;
 
-    newfs_super_d.inode_offset        = newfs_super.inode_offset;
-    newfs_super_d.data_offset         = newfs_super.data_offset;
+        newfs_super_d.map_inode_blks      = newfs_super.map_inode_blks;
+        newfs_super_d.map_inode_offset    = newfs_super.map_inode_offset;
+        newfs_super_d.map_data_blks       = newfs_super.map_data_blks;
+        newfs_super_d.map_data_offset     = newfs_super.map_data_offset;
 
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
-                     sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+        newfs_super_d.inode_offset        = newfs_super.inode_offset;
+        newfs_super_d.data_offset         = newfs_super.data_offset;
+        newfs_super_d.max_ino             = newfs_super.max_ino;
+        newfs_super_d.max_data            = newfs_super.max_data;
+        newfs_super_d.groups              = newfs_super.groups;
+        newfs_super_d.ino_per_group       = newfs_super.ino_per_group;
+        newfs_super_d.data_per_group      = newfs_super.data_per_group;
+        newfs_super_d.group_blks          = newfs_super.group_sz / NEWFS_BLK_SZ();
+        newfs_super_d.journal_offset      = NEWFS_BLKS_SZ(newfs_super.journal.blkno);
+        newfs_super_d.journal_blks        = newfs_super.journal.blks;
+
+        if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
+                         sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_super.is_super_dirty = FALSE;
     }
 
-    if (newfs_driver_write(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-                         NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 提交：脏元数据写入块缓存后作为一个事务顺序写入日志，原位置留给检查点；
+ * 没有日志时整体刷写。fsync经 newfs_journal_sync 调用，调用者持有命名空间写锁
+ * 
+ * @return int 
+ */
+int newfs_commit() {
+    if (!newfs_super.journal.is_enabled) {
+        return newfs_flush();
+    }
+    newfs_journal_begin();
+    if (newfs_sync_meta() != NEWFS_ERROR_NONE || newfs_journal_commit() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal_synced();
+    newfs_mark_clean();
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将所有脏元数据及块缓存刷回磁盘。启用日志时只提交，检查点由回写线程在命名空间写锁之外
+ * 按日志用量进行，卸载时再做；没有日志时写回原位置。由回写线程周期性调用，卸载时再调用一次，
+ * 调用者持有命名空间写锁
+ * 
+ * @return int 
+ */
+int newfs_flush() {
+    newfs_journal_begin();
+    if (newfs_sync_meta() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_super.journal.is_enabled) {
+        if (newfs_journal_commit() != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_journal_synced();
+    }
+    else if (newfs_bcache_flush() != NEWFS_ERROR_NONE ||      /* 脏块全部回写并落盘 */
+             newfs_dev_flush() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    newfs_mark_clean();
+    newfs_bitmap_unpin(&newfs_super.bm_data);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 
+ * 
+ * @return int 
+ */
+int newfs_umount() {
+    struct newfs_inode* inode;
+    int ino;
+
+    if (!newfs_super.is_mounted) {
+        return NEWFS_ERROR_NONE;
+    }
 
-    if (newfs_driver_write(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
-                         NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
+    if (newfs_flush() != NEWFS_ERROR_NONE ||
+        newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    newfs_journal_umount();
+    newfs_bcache_destroy();
+    newfs_dcache_destroy();
+
+    /* dentry、inode和名字随slab整体释放，只有inode的变长数组按inode号表逐个释放 */
+    for (ino = 0; ino < newfs_super.max_ino; ino++) {
+        if (newfs_super.ino_dentry[ino] != NULL &&
+            (inode = newfs_super.ino_dentry[ino]->inode) != NULL) {
+            free(inode->extents);
+            free(inode->dind_blks);
+            free(inode->index);
+            free(inode->dir_free);
+            free(inode->slots);
+        }
+    }
+    newfs_slabs_destroy();
+    newfs_super.root_dentry = NULL;
 
+    newfs_bitmap_destroy(&newfs_super.bm_inode);
+    newfs_bitmap_destroy(&newfs_super.bm_data);
     free(newfs_super.map_inode);
     free(newfs_super.map_data);
-    ddriver_close(NEWFS_DRIVER());
+    free(newfs_super.map_inode_dirty);
+    free(newfs_super.map_data_dirty);
+    free(newfs_super.ino_dentry);
+    free(newfs_super.nlookup);
+    newfs_super.ino_dentry = NULL;
+    newfs_super.nlookup    = NULL;
+    newfs_super.dev->close(NEWFS_DRIVER());
+    newfs_super.is_mounted = FALSE;
 
     return NEWFS_ERROR_NONE;
 }
-
@@ -0,0 +1,190 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+#define NEWFS_WB()                        (&newfs_super.wb)
+
+/**
+ * @brief 单调时钟，毫秒
+ *
+ * @return long
+ */
+static long newfs_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+/**
+ * @brief 记录新产生的脏数据，超过阈值时唤醒回写线程。每次调用对应下一次提交要写的若干块，
+ * 不足一块的按一块计入 dirty_blks
+ *
+ * @param bytes 新增脏数据字节数
+ */
+void newfs_mark_dirty(int bytes) {
+    struct newfs_wb* wb = NEWFS_WB();
+    pthread_mutex_lock(&wb->lock);
+    if (wb->dirty_since_ms == 0) {
+        wb->dirty_since_ms = newfs_now_ms();
+    }
+    wb->dirty_bytes += bytes;
+    wb->dirty_blks  += (bytes + NEWFS_BLK_SZ() - 1) / NEWFS_BLK_SZ();
+    if (wb->is_running && wb->dirty_bytes >= wb->dirty_thresh) {
+        pthread_cond_signal(&wb->cond);
+    }
+    pthread_mutex_unlock(&wb->lock);
+}
+/**
+ * @brief 刷写完成，清空脏数据统计
+ *
+ */
+void newfs_mark_clean() {
+    struct newfs_wb* wb = NEWFS_WB();
+    pthread_mutex_lock(&wb->lock);
+    wb->dirty_bytes    = 0;
+    wb->dirty_blks     = 0;
+    wb->dirty_since_ms = 0;
+    pthread_mutex_unlock(&wb->lock);
+}
+/**
+ * @brief 脏块数是否达到空日志容量的一半，留出另一半给已通过检查、尚未完成的修改操作
+ *
+ * @return boolean
+ */
+static boolean newfs_wb_over_limit() {
+    struct newfs_wb* wb = NEWFS_WB();
+    boolean is_over;
+    pthread_mutex_lock(&wb->lock);
+    is_over = wb->dirty_blks >= newfs_super.journal.cap / 2;
+    pthread_mutex_unlock(&wb->lock);
+    return is_over;
+}
+/**
+ * @brief 修改操作在取命名空间锁之前调用：脏块过多时由调用线程先刷写，
+ * 使每次提交都能作为一个事务完整写入日志，不必拆开
+ *
+ */
+void newfs_wb_throttle() {
+    struct newfs_wb* wb = NEWFS_WB();
+
+    if (!newfs_super.journal.is_enabled || !newfs_wb_over_limit()) {
+        return;
+    }
+    NEWFS_WRLOCK();
+    if (newfs_wb_over_limit()) {                      /* 等待写锁期间可能已被其他线程刷写 */
+        if (newfs_flush() != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] flush error\n", __func__);
+        }
+        pthread_mutex_lock(&wb->lock);
+        wb->throttles++;
+        pthread_mutex_unlock(&wb->lock);
+    }
+    NEWFS_UNLOCK();
+}
+/**
+ * @brief 是否需要回写：脏数据超过阈值，或最早的脏数据超过驻留时间，调用者持有wb->lock
+ *
+ * @return boolean
+ */
+static boolean newfs_wb_need_flush() {
+    struct newfs_wb* wb = NEWFS_WB();
+    if (wb->dirty_since_ms == 0) {
+        return FALSE;
+    }
+    return wb->dirty_bytes >= wb->dirty_thresh ||
+           newfs_now_ms() - wb->dirty_since_ms >= wb->expire_ms;
+}
+/**
+ * @brief 回写线程，每 interval_ms 或被阈值唤醒时检查一次，
+ * 刷写前放开wb->lock再取命名空间写锁，等待期间不妨碍其他线程产生脏数据；
+ * 随后在命名空间锁之外检查日志用量，必要时做检查点
+ *
+ * @param arg
+ * @return void*
+ */
+static void* newfs_wb_thread(void* arg) {
+    struct newfs_wb* wb = NEWFS_WB();
+    struct timespec  ts;
+    (void)arg;
+
+    pthread_mutex_lock(&wb->lock);
+    while (wb->is_running) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec  += wb->interval_ms / 1000;
+        ts.tv_nsec += (wb->interval_ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&wb->cond, &wb->lock, &ts);
+        if (!wb->is_running) {
+            break;
+        }
+        if (newfs_wb_need_flush()) {
+            pthread_mutex_unlock(&wb->lock);
+            NEWFS_WRLOCK();
+            if (newfs_flush() != NEWFS_ERROR_NONE) {
+                NEWFS_DBG("[%s] flush error\n", __func__);
+            }
+            NEWFS_UNLOCK();
+            pthread_mutex_lock(&wb->lock);
+            wb->flushes++;
+        }
+        pthread_mutex_unlock(&wb->lock);
+        if (newfs_journal_reclaim() != NEWFS_ERROR_NONE) {      /* 不持有命名空间锁 */
+            NEWFS_DBG("[%s] checkpoint error\n", __func__);
+        }
+        pthread_mutex_lock(&wb->lock);
+    }
+    pthread_mutex_unlock(&wb->lock);
+    return NULL;
+}
+/**
+ * @brief 启动回写线程，wb_interval_ms 为0时不启动，只在卸载时刷写
+ *
+ * @param options
+ * @return int
+ */
+int newfs_wb_start(struct custom_options options) {
+    struct newfs_wb*   wb = NEWFS_WB();
+    pthread_condattr_t attr;
+
+    wb->interval_ms  = options.wb_interval_ms;
+    wb->expire_ms    = options.wb_expire_ms;
+    wb->dirty_thresh = options.wb_dirty_kb * 1024;
+    wb->flushes      = 0;
+    if (wb->interval_ms <= 0) {
+        return NEWFS_ERROR_NONE;
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wb->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&wb->lock);
+    wb->is_running = TRUE;
+    pthread_mutex_unlock(&wb->lock);
+    if (pthread_create(&wb->tid, NULL, newfs_wb_thread, NULL) != 0) {
+        wb->is_running = FALSE;
+        pthread_cond_destroy(&wb->cond);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 停止回写线程，剩余的脏数据由 newfs_umount 刷写
+ *
+ */
+void newfs_wb_stop() {
+    struct newfs_wb* wb = NEWFS_WB();
+    if (!wb->is_running) {
+        return;
+    }
+    pthread_mutex_lock(&wb->lock);
+    wb->is_running = FALSE;
+    pthread_cond_signal(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->tid, NULL);
+    pthread_cond_destroy(&wb->cond);
+    NEWFS_DBG("[%s] background flushes %d, throttled %d\n", __func__, wb->flushes, wb->throttles);
+}
@@ -0,0 +1,86 @@
+#!/bin/bash
+# 比较 read_buf/write_buf 路径与 --no_buf_io 路径的读写吞吐量
+# 用法: ./rw_bench.sh [文件大小MB，默认64] [后端，默认file]
+# 文件远大于块缓存（默认64块），测到的是数据路径本身。file/uring 后端在镜像文件上运行，
+# read_buf 的整块直接从镜像文件splice给内核；ddriver 后端的磁盘只有4MB，且无法splice。
+# 写入的是随机内容，重新挂载读出后比较校验和，数据错误时退出码非0
+
+SIZE_MB=${1:-64}
+BACKEND=${2:-file}
+ROOT_PATH=$(cd "$(dirname "$0")" && pwd)
+BIN="$ROOT_PATH"/../../build/newfs
+MKFS="$ROOT_PATH"/../../build/mkfs.newfs
+MNTPOINT="$ROOT_PATH"/mnt
+if [ "$BACKEND" == "ddriver" ]; then
+    DEVICE="$HOME"/ddriver
+else
+    DEVICE="$ROOT_PATH"/bench.img
+fi
+SRC=$(mktemp)
+head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$SRC"
+GOLDEN=$(sha256sum < "$SRC")
+
+function clean_ddriver() {
+    rm "$DEVICE" -f
+    touch "$DEVICE"
+    if [ "$BACKEND" != "ddriver" ]; then
+        truncate -s $((SIZE_MB * 2 + 16))M "$DEVICE"
+        "$MKFS" --backend="$BACKEND" "$DEVICE" >/dev/null || exit 1
+    fi
+}
+
+function clean_mount() {
+    while mount | grep "$(realpath "$MNTPOINT")" >/dev/null; do
+        fusermount -u "$MNTPOINT" 2>/dev/null || umount "$MNTPOINT"
+        sleep 0.2
+    done
+}
+
+# input: 耗时(秒)
+function mbps() {
+    awk -v s="$1" -v m="$SIZE_MB" 'BEGIN { if (s > 0) printf "%.1f", m / s; else print "inf" }'
+}
+
+# input: 模式名 额外挂载参数
+function bench() {
+    local mode=$1
+    shift
+    local start end t_write t_read
+
+    clean_mount
+    clean_ddriver
+    "$BIN" --device="$DEVICE" --backend="$BACKEND" "$@" "$MNTPOINT" || exit 1
+    sleep 0.5
+
+    start=$(date +%s.%N)
+    dd if="$SRC" of="$MNTPOINT"/bench bs=1M conv=fsync status=none
+    end=$(date +%s.%N)
+    t_write=$(echo "$end - $start" | bc)
+
+    clean_mount
+    "$BIN" --device="$DEVICE" --backend="$BACKEND" "$@" "$MNTPOINT" || exit 1
+    sleep 0.5
+
+    start=$(date +%s.%N)
+    dd if="$MNTPOINT"/bench of=/dev/null bs=1M status=none
+    end=$(date +%s.%N)
+    t_read=$(echo "$end - $start" | bc)
+
+    printf "%-10s write %8s MB/s    read %8s MB/s\n" "$mode" "$(mbps "$t_write")" "$(mbps "$t_read")"
+    if [ "$(sha256sum < "$MNTPOINT"/bench)" != "$GOLDEN" ]; then
+        echo "$mode: 读出的内容与写入的不同"
+        FAILED=1
+    fi
+    clean_mount
+}
+
+FAILED=0
+mkdir -p "$MNTPOINT"
+bench "buf_io"
+bench "no_buf_io" --no_buf_io
+rmdir "$MNTPOINT"
+rm -f "$SRC"
+if [ "$BACKEND" != "ddriver" ]; then
+    rm -f "$DEVICE"
+fi
+exit $FAILED
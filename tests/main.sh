@@ -3,12 +3,13 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigfile.sh replay.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 4 2)
 MNTPOINT='./mnt'
 PROJECT_NAME="newfs"
 
 LEVEL=$1
+BACKEND=${2:-ddriver}   # 块设备后端：ddriver（默认）、file或uring，后两者在格式化好的镜像文件上运行
 
 
 if [[ "${LEVEL}" == "1" ]]; then
@@ -28,12 +29,12 @@ elif [[ "${LEVEL}" == "4" ]]; then
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
     sleep 1
 elif [[ "${LEVEL}" == "5" ]]; then
-    echo "开始mount, mkdir, touch, ls, read&write, umount测试"
-    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh)
+    echo "开始mount, mkdir, touch, ls, read&write, umount, 大文件, 日志重放测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh bigfile.sh replay.sh)
     sleep 1
 elif [[ "${LEVEL}" == "6" ]]; then
-    echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
-    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, 大文件, 日志重放测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh bigfile.sh replay.sh)
     sleep 1
 else
     echo "未知测试参数"
@@ -81,6 +82,10 @@ function core_tester() {
 function clean_ddriver() {
     rm ~/ddriver -f
     touch ~/ddriver
+    if [[ "${BACKEND}" != "ddriver" ]]; then      # 与ddriver磁盘同样大小的镜像文件
+        truncate -s 4M ~/ddriver
+        "$ROOT_PATH"/../build/mkfs."${PROJECT_NAME}" --backend="${BACKEND}" "$HOME"/ddriver >/dev/null || exit 1
+    fi
 }
 
 function pass() {
@@ -96,7 +101,7 @@ function fail() {
 
 # Utils
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver --backend="${BACKEND}" "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - large file"
+
+# 两个文件逐块交替写入，每块各成一个extent，超出inode中的直接extent，用到一级和二级间接块；
+# 文件远大于块缓存，重新挂载后读出的是磁盘上的内容（含直接splice的整块）
+BLKS=512
+SRC=$(mktemp)
+head -c $((BLKS * 1024)) /dev/urandom > "$SRC"
+GOLDEN=$(sha256sum < "$SRC")
+
+# input: 文件 期望的sha256sum输出
+function check_sum () {
+    _FILE=$1
+    _GOLDEN=$2
+
+    if [[ "$(sha256sum < "$_FILE")" != "$_GOLDEN" ]]; then
+        fail "$_TEST_CASE: 文件$_FILE内容与写入的不同"
+        return 1
+    fi
+    return 0
+}
+
+function remount () {
+    clean_mount
+    try_mount_or_fail
+}
+
+function check_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for ((i = 0; i < BLKS; i++)); do
+        for f in big0 big1; do
+            if ! dd if="$SRC" of="${MNTPOINT}"/$f bs=1024 skip=$i seek=$i count=1 conv=notrunc status=none; then
+                fail "$_TEST_CASE: 写文件${MNTPOINT}/$f的第$i块失败"
+                return 1
+            fi
+        done
+    done
+    check_sum "${MNTPOINT}"/big0 "$GOLDEN" && check_sum "${MNTPOINT}"/big1 "$GOLDEN"
+}
+
+function check_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    remount
+    check_sum "${MNTPOINT}"/big0 "$GOLDEN" && check_sum "${MNTPOINT}"/big1 "$GOLDEN"
+}
+
+# 先截短到extent中间的块内，再扩展回来：截掉的部分须读出为0
+TRUNC_SZ=$((BLKS * 1024 / 3 + 123))
+TRUNC_GOLDEN=$( (head -c $TRUNC_SZ "$SRC"; head -c $((BLKS * 1024 - TRUNC_SZ)) /dev/zero) | sha256sum)
+
+function check_truncate () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! truncate -s $TRUNC_SZ "${MNTPOINT}"/big0 || ! truncate -s $((BLKS * 1024)) "${MNTPOINT}"/big0; then
+        fail "$_TEST_CASE: 截断文件${MNTPOINT}/big0失败"
+        return 1
+    fi
+    check_sum "${MNTPOINT}"/big0 "$TRUNC_GOLDEN" && check_sum "${MNTPOINT}"/big1 "$GOLDEN"
+}
+
+function check_truncate_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    remount
+    check_sum "${MNTPOINT}"/big0 "$TRUNC_GOLDEN" && check_sum "${MNTPOINT}"/big1 "$GOLDEN"
+}
+
+try_mount_or_fail
+
+touch_and_check "${MNTPOINT}"/big0
+touch_and_check "${MNTPOINT}"/big1
+
+TEST_CASE="case 9.1 - interleaved write ${MNTPOINT}/big0 and ${MNTPOINT}/big1"
+core_tester echo "$TEST_CASE" check_write "$TEST_CASE"
+
+TEST_CASE="case 9.2 - read back after remount"
+core_tester echo "$TEST_CASE" check_remount "$TEST_CASE"
+
+TEST_CASE="case 9.3 - truncate ${MNTPOINT}/big0"
+core_tester echo "$TEST_CASE" check_truncate "$TEST_CASE"
+
+TEST_CASE="case 9.4 - read back truncated file after remount"
+core_tester echo "$TEST_CASE" check_truncate_remount "$TEST_CASE"
+
+rm -f "$SRC"
+clean_mount
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - journal replay"
+
+GOLDEN="journal replay: committed by fsync, survives kill -9 without umount"
+
+function kill_fuse () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 不经umount直接杀死进程，日志中已提交的事务只能靠下次挂载重放
+    pkill -9 -f "${PROJECT_NAME} .*$(realpath "${MNTPOINT}")"
+    sleep 1
+    umount -l "${MNTPOINT}" 2>/dev/null || fusermount -u "${MNTPOINT}" 2>/dev/null
+    if check_mount; then
+        fail "$_TEST_CASE: 杀死$PROJECT_NAME进程后挂载点${MNTPOINT}仍然存在"
+        return 1
+    fi
+    return 0
+}
+
+function check_replay () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if [ ! -d "${MNTPOINT}"/jdir ]; then
+        fail "$_TEST_CASE: 重新挂载后目录${MNTPOINT}/jdir不存在, 已提交的日志事务没有重放"
+        return 1
+    fi
+    OUTPUT=$(cat "${MNTPOINT}"/jdir/jfile)
+    if [[ "${OUTPUT}" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后${MNTPOINT}/jdir/jfile内容不同, 正确的内容为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}/jdir"
+touch_and_check "${MNTPOINT}/jdir/jfile"
+# conv=fsync 触发提交：目录、文件及其内容一起写入日志
+echo "$GOLDEN" | dd of="${MNTPOINT}"/jdir/jfile conv=fsync status=none
+
+TEST_CASE="case 8.1 - kill ${PROJECT_NAME} without umount"
+core_tester ls "${MNTPOINT}" kill_fuse "$TEST_CASE"
+
+try_mount_or_fail
+
+TEST_CASE="case 8.2 - check ${MNTPOINT}/jdir/jfile after replay"
+core_tester ls "${MNTPOINT}" check_replay "$TEST_CASE"
+
+clean_mount